@@ -27,7 +27,10 @@
 #define __STDC_CONSTANT_MACROS
 #endif
 
-// libavcodec massive headers
+// libavcodec massive headers (not warning clean at /W4)
+#ifdef _MSC_VER
+#pragma warning(push, 3)
+#endif
 #ifdef __cplusplus
 extern "C"
 {
@@ -35,17 +38,79 @@ extern "C"
 	#include <avcodec.h>
 	#include <avformat.h>
 	#include <swscale.h>
+	#include <imgutils.h>
+	#include <pixdesc.h>
+	#include <cpu.h>
 #ifdef __cplusplus
 }
 #endif
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#include <emmintrin.h>
 
 // globals
-bool              libav_initialized = false;
+volatile bool     libav_initialized = false;
+volatile LONG     libav_init_state = 0;      // 0 - not initialized, 1 - initializing, 2 - initialized
 unsigned int      libav_codec_version = 0;
 unsigned int      libav_format_version = 0;
 unsigned int      libav_util_version = 0;
 unsigned int      libav_swscale_version = 0;
 avwCallbackPrint *libav_print = NULL;
+int64_t           libav_memfile_limit = 0;
+int64_t           libav_memory_limit = 0;
+CRITICAL_SECTION  libav_print_lock;
+int64_t           libav_timer_frequency = 1; // QueryPerformanceCounter ticks per second
+
+#define LIBAVW_MAX_IDENTITY 256
+#define LIBAVW_MIP_CONTEXTS 16           // mip levels converted by swscale, smaller ones are box filtered
+#define LIBAVW_SCALER_BASESIZE 32768     // SwsContext itself and its color tables
+
+// demuxed packets waiting for decoder
+typedef struct avwpacketnode_s
+{
+	AVPacket         pkt;
+	struct avwpacketnode_s *next;
+}avwpacketnode_t;
+
+typedef struct avwpacketqueue_s
+{
+	avwpacketnode_t *first;
+	avwpacketnode_t *last;
+	int              numpackets;
+	int64_t          bytes;
+	int64_t          maxbytes;
+	double           duration;           // seconds
+	bool             eof;
+}avwpacketqueue_t;
+
+// disk frame cache file header, frames follow at LIBAVW_DISKCACHE_HEADER
+#define LIBAVW_DISKCACHE_VERSION 1
+#define LIBAVW_DISKCACHE_HEADER  4096    // keeps frames page-aligned in mapping
+typedef struct avwdiskheader_s
+{
+	char             magic[4];           // "AVWC"
+	int              version;
+	char             identity[LIBAVW_MAX_IDENTITY];
+	int              alphamode;
+	int              pixelformat;
+	int              width;
+	int              height;
+	int              scaler;             // of first frame, may change under LIBAVW_SCALER_AUTO
+	int              imagesize;
+	int              numframes;          // 0 until file is complete
+}avwdiskheader_t;
+
+// scale context kept between frames, along with memory it is counted for
+typedef struct avwscalecontext_s
+{
+	SwsContext      *context;
+	int              bytes;
+}avwscalecontext_t;
 
 // internal struct that holds video
 typedef struct avwstream_s
@@ -63,7 +128,9 @@ typedef struct avwstream_s
     int              AV_VideoStreamId;
 	int              AV_AudioStreamId;
     AVCodecContext  *AV_CodecContext;
-    AVCodec         *AV_Codec;
+    AVCodec         *AV_Codec;           // NULL until decoder is opened
+	bool             lowres;             // decoder is opened at lower resolution to save memory
+	bool             sequential;         // decoding went on from first frame without seeking, end of stream gives length
 	AVFrame         *AV_InputFrame;
 	AVFrame         *AV_OutputFrame;
 
@@ -72,6 +139,120 @@ typedef struct avwstream_s
 	avwCallbackIoRead *IO_Read;
 	avwCallbackIoSeek *IO_Seek;
 	avwCallbackIoSeekSize *IO_SeekSize;
+
+	// whole file loaded into memory (small files)
+	unsigned char     *memfile;
+	int64_t            memfile_size;
+	int64_t            memfile_pos;
+
+	// converted frame cache (for short looping clips)
+	int64_t          cache_budget;       // 0 if cache is disabled, survives stream reset
+	int64_t          cache_size;
+	unsigned char  **cache_frames;       // indexed by framenum - 1
+	int              cache_maxframes;
+	int              cache_numframes;    // stream length, known after first pass
+	int              cache_imagesize;
+	int              cache_pixelformat;
+	int              cache_width;
+	int              cache_height;
+	int              cache_scaler;
+	bool             cache_overflow;     // budget exceeded, no caching until stream reset
+	bool             cache_playing;      // serving frames from cache, decoder is bypassed
+	CRITICAL_SECTION cache_lock;         // held while cache is read or filled, opens of other streams drop it
+
+	// tiled output of scaled or alpha-packed video goes through full converted frame
+	uint8_t         *tile_image;
+	int              tile_imagesize;
+
+	// disk frame cache, path survives stream reset
+	char             disk_path[MAX_PATH];
+	int              disk_pixelformat;   // output settings cache file is written and matched for
+	int              disk_width;
+	int              disk_height;
+	int              disk_scaler;        // LIBAVW_SCALER_AUTO takes cache file of any scaler
+	avwdiskheader_t  disk_header;        // header of cache file being written
+	HANDLE           disk_file;          // cache file being written during first pass
+	int              disk_written;       // frames written to it
+	bool             disk_finished;      // cache file written or abandoned, nothing to write until stream reset
+	HANDLE           disk_mapping;
+	unsigned char   *disk_view;          // mapped complete cache file, cache_* fields describe it
+
+	// memory held by this stream
+	avwmemorystats_t memory;
+
+	// LIBAVW_DECODE_*, survives stream reset
+	int              decodemode;
+	char             identity[LIBAVW_MAX_IDENTITY]; // caller-provided file identity, survives stream reset
+	int              alphamode;          // LIBAVW_ALPHA_* layout and flags, survives stream reset
+	double           rate;               // playback speed, survives stream reset
+
+	// LIBAVW_SCALER_AUTO state, survives stream reset
+	int              scaler_budget;      // conversion budget in microseconds, 0 - use global one
+	int              auto_level;         // index into libav_autoscalers
+	double           auto_cost;          // smoothed conversion time in microseconds
+	int              auto_samples;       // conversions measured since last step
+	int              auto_under;         // conversions in a row well under budget
+	int              auto_upwait;        // conversions well under budget needed to step up
+	bool             auto_raised;        // stepped up recently
+	double           clock;              // stream time advanced by LibAvW_PlayAdvance
+	double           clock_pts;          // presented frame time after last advance
+	bool             skipped_refs;       // non-key frames were skipped, decoder lacks references until next keyframe
+
+	// current frame timing
+	double           frame_pts;
+	double           frame_duration;
+
+	// reverse playback
+	bool             reverse;
+	struct avwrevgop_s   *rev_front;     // GOP frames are handed out from, last to first
+	struct avwrevgop_s   *rev_back;      // previous GOP, filled by prefetch thread
+	struct avwrevframe_s *rev_current;
+	int              rev_pos;
+	double           rev_boundary;       // prefetch decodes frames before this time
+	bool             rev_pending;        // prefetch is in progress
+	volatile bool    rev_quit;
+	HANDLE           rev_thread;
+	HANDLE           rev_wake;
+	HANDLE           rev_filled;
+
+	// non-blocking I/O, frame is decoded on a fiber which is left when read would block
+	bool             nonblocking;        // survives stream reset
+	LPVOID           io_fiber;
+	LPVOID           io_caller;
+	bool             io_inside;          // running on io_fiber
+	bool             io_done;            // io_fiber finished its frame
+	bool             io_abort;           // would-block reads fail so pending frame unwinds
+	int              io_result;
+
+	// pipelined demuxing
+	bool             pipelined;          // survives stream reset
+	avwpacketqueue_t videoqueue;
+	avwpacketqueue_t audioqueue;         // read ahead for audio decoding, oldest packets are dropped when full
+	CRITICAL_SECTION demux_lock;
+	struct avwstream_s *next;            // all created streams, for dropping caches
+	HANDLE           demux_thread;
+	HANDLE           demux_data;         // signalled when packets are queued
+	HANDLE           demux_space;        // signalled when packets are taken
+	volatile bool    demux_quit;
+	volatile bool    demux_abort;        // starved read may be abandoned, demuxer is seeked after stop
+
+	// scale contexts kept between frames
+	avwscalecontext_t sws_image;
+	avwscalecontext_t sws_matte;
+	avwscalecontext_t sws_mip;
+	avwscalecontext_t sws_miplevels[LIBAVW_MIP_CONTEXTS];
+	avwscalecontext_t sws_tiles[9];      // by tile position class (first, inner, last column and row)
+
+	// allocation tracing (LIBAVW_ALLOCTRACE builds)
+	avwallocstats_t  allocstats;
+
+	// decoding stops between packets when past this LibAvW_Timer time, 0 is no limit
+	int64_t          decode_deadline;
+
+	// frame ready notification, survives stream reset
+	avwCallbackFrameReady *frameready;
+	void            *frameready_data;
+	HANDLE           frameready_event;
 }avwstream_t;
 
 // scalers
@@ -90,6 +271,41 @@ int libav_scalers[LIBAVCODEC_SCALERS] =
 	SWS_SPLINE
 };
 
+// LIBAVW_SCALER_AUTO steps, best to fastest
+#define LIBAVW_AUTOSCALER_LEVELS    4
+#define LIBAVW_AUTOSCALER_DOWNWAIT  4    // conversions over budget before stepping down
+#define LIBAVW_AUTOSCALER_UPWAIT    30   // conversions well under budget before stepping up, doubled on bounce
+#define LIBAVW_AUTOSCALER_MAXUPWAIT 960
+int libav_autoscalers[LIBAVW_AUTOSCALER_LEVELS] =
+{
+	LIBAVW_SCALER_SPLINE,
+	LIBAVW_SCALER_BICUBIC,
+	LIBAVW_SCALER_BILINEAR,
+	LIBAVW_SCALER_POINT
+};
+int libav_scaler_budget = 4000;          // microseconds per conversion
+
+// LibAvW_Timer
+// QueryPerformanceCounter ticks
+int64_t LibAvW_Timer(void)
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+// LibAvW_GetPixelFormat
+// returns libav pixel format for LIBAVW_PIXEL_FORMAT_*, PIX_FMT_NONE if unsupported
+PixelFormat LibAvW_GetPixelFormat(int pixel_format)
+{
+	if (pixel_format == LIBAVW_PIXEL_FORMAT_BGR)
+		return PIX_FMT_BGR24;
+	if (pixel_format == LIBAVW_PIXEL_FORMAT_BGRA)
+		return PIX_FMT_BGRA;
+	return PIX_FMT_NONE;
+}
+
 // error codes
 #define LIBAVW_ERROR_NONE                  0
 #define LIBAVW_ERROR_DLL_VERSION_AVCODEC   1
@@ -115,263 +331,4308 @@ int libav_scalers[LIBAVCODEC_SCALERS] =
 #define LIBAVW_ERROR_CREATE_SCALE_CONTEXT  21
 #define LIBAVW_ERROR_APPLYING_SCALE        22
 #define LIBAVW_ERROR_TEST                  23
+#define LIBAVW_ERROR_SEEK                  24
+#define LIBAVW_ERROR_MEMORY_LIMIT          25
+#define LIBAVW_ERROR_LOCK_MANAGER          26
+#define LIBAVW_ERROR_BAD_DECODE_MODE       27
+#define LIBAVW_ERROR_BAD_PLAYBACK_RATE     28
+#define LIBAVW_ERROR_BAD_ALPHA_MODE        29
+#define LIBAVW_ERROR_BAD_SCALER_BUDGET     30
+#define LIBAVW_ERROR_BAD_DISK_CACHE_PATH   31
+#define LIBAVW_ERROR_BAD_TILES             32
+#define LIBAVW_ERROR_IO_PENDING            33
+#define LIBAVW_ERROR_BATCH_REVERSE         34
 
 /*
 =================================================================
 
- Video Stream
+ Worker Threads
 
 =================================================================
 */
 
-// LibAvW_ResetStream
-void LibAvW_ResetStream(avwstream_t *stream)
+#define LIBAVW_MAX_WORKERS 16
+
+typedef void avwjobfunc_t(void *data, int index);
+
+// job list of one LibAvW_RunJobs call, lives on its stack
+typedef struct avwjobs_s
 {
-	stream->framerate = 0;
-	stream->numframes = 0;
-	stream->framewidth = 0;
-	stream->frameheight = 0;
-	stream->framenum = 0;
-	stream->lasterror = LIBAVW_ERROR_NONE;
-	stream->AV_VideoStreamId = -1;
-	stream->AV_AudioStreamId = -1;
-	stream->AV_Codec = NULL;
-	// AV_InputFrame
-	if (stream->AV_InputFrame)
-		av_free(stream->AV_InputFrame);
-	stream->AV_InputFrame = NULL;
-	// AV_OutputFrame
-	if (stream->AV_OutputFrame)
-		av_free(stream->AV_OutputFrame);
-	stream->AV_OutputFrame = NULL;
-	// AV_CodecContext
-	if (stream->AV_CodecContext)
-		avcodec_close(stream->AV_CodecContext);
-	stream->AV_CodecContext = NULL;
-	// AV_InputContext
-	if (stream->AV_InputContext)
+	avwjobfunc_t  *func;
+	void          *data;
+	LONG           count;
+	volatile LONG  next;
+	volatile LONG  pending;
+	volatile LONG  users;                // workers holding this list
+}avwjobs_t;
+
+bool              libav_workers_started = false;
+int               libav_numworkers = 0;
+HANDLE            libav_workers[LIBAVW_MAX_WORKERS];
+HANDLE            libav_jobs_semaphore = NULL;
+HANDLE            libav_jobs_done = NULL;
+CRITICAL_SECTION  libav_jobs_lock;
+CRITICAL_SECTION  libav_jobs_current_lock;
+avwjobs_t        *libav_jobs_current = NULL;
+
+// LibAvW_DoJobs
+// pulls jobs until list is exhausted
+void LibAvW_DoJobs(avwjobs_t *jobs)
+{
+	LONG index;
+
+	for (;;)
 	{
-		av_free(stream->AV_InputContext);
-		stream->AV_InputContext = NULL;
-		if (stream->AV_FormatContext)
-			stream->AV_FormatContext->pb = NULL;
+		index = InterlockedIncrement(&jobs->next) - 1;
+		if (index >= jobs->count)
+			return;
+		jobs->func(jobs->data, (int)index);
+		if (InterlockedDecrement(&jobs->pending) == 0)
+			SetEvent(libav_jobs_done);
 	}
-	// AV_FormatContext
-	if (stream->AV_FormatContext)
-		av_close_input_file(stream->AV_FormatContext);
-	stream->AV_InputContext = NULL;
-	stream->AV_FormatContext = NULL;
-	// IO
-	stream->file = NULL;
-	stream->IO_Read = NULL;
-	stream->IO_Seek = NULL;
-	stream->IO_SeekSize = NULL;
 }
 
-// LibAvW_StreamGetVideoWidth
-DLL_EXPORT int LibAvW_StreamGetVideoWidth(void *stream)
+// LibAvW_WorkerThread
+unsigned int __stdcall LibAvW_WorkerThread(void *arg)
 {
-	avwstream_t *s;
+	avwjobs_t *jobs;
 
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+	(void)arg; // jobs are taken from shared list
+	for (;;)
+	{
+		WaitForSingleObject(libav_jobs_semaphore, INFINITE);
 
-	s->lasterror = LIBAVW_ERROR_NONE;
-	return s->framewidth;
+		// late wakeups find no list or a newer one, jobs are only taken from the list grabbed here
+		EnterCriticalSection(&libav_jobs_current_lock);
+		jobs = libav_jobs_current;
+		if (jobs)
+			InterlockedIncrement(&jobs->users);
+		LeaveCriticalSection(&libav_jobs_current_lock);
+		if (!jobs)
+			continue;
+		LibAvW_DoJobs(jobs);
+		InterlockedDecrement(&jobs->users);
+	}
+	return 0;
 }
 
-// LibAvW_StreamGetVideoHeight
-DLL_EXPORT int LibAvW_StreamGetVideoHeight(void *stream)
+// LibAvW_StartWorkers
+// workers are started on first use and live until library is unloaded
+void LibAvW_StartWorkers(void)
 {
-	avwstream_t *s;
-
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+	SYSTEM_INFO info;
+	HANDLE thread;
+	int i, numworkers;
 
-	s->lasterror = LIBAVW_ERROR_NONE;
-	return s->frameheight;
+	libav_workers_started = true;
+	GetSystemInfo(&info);
+	numworkers = FFMIN((int)info.dwNumberOfProcessors - 1, LIBAVW_MAX_WORKERS);
+	if (numworkers <= 0)
+		return;
+	libav_jobs_semaphore = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+	libav_jobs_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!libav_jobs_semaphore || !libav_jobs_done)
+		return;
+	for (i = 0; i < numworkers; i++)
+	{
+		thread = (HANDLE)_beginthreadex(NULL, 0, LibAvW_WorkerThread, NULL, 0, NULL);
+		if (!thread)
+			break;
+		libav_workers[libav_numworkers++] = thread;
+	}
 }
 
-// LibAvW_StreamGetFramerate
-DLL_EXPORT double LibAvW_StreamGetFramerate(void *stream)
+// LibAvW_RunJobs
+// calls func for every index in [0, count) spreading calls across worker threads, returns when all are done
+void LibAvW_RunJobs(avwjobfunc_t *func, void *data, int count)
 {
-	avwstream_t *s;
+	avwjobs_t jobs;
+	int i;
 
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+	if (count <= 0)
+		return;
+	EnterCriticalSection(&libav_jobs_lock);
+	if (!libav_workers_started)
+		LibAvW_StartWorkers();
+	if (libav_numworkers <= 0 || count == 1)
+	{
+		LeaveCriticalSection(&libav_jobs_lock);
+		for (i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
 
-	s->lasterror = LIBAVW_ERROR_NONE;
-	return s->framerate;
+	// publish job list
+	jobs.func = func;
+	jobs.data = data;
+	jobs.count = count;
+	jobs.next = 0;
+	jobs.pending = count;
+	jobs.users = 0;
+	EnterCriticalSection(&libav_jobs_current_lock);
+	libav_jobs_current = &jobs;
+	LeaveCriticalSection(&libav_jobs_current_lock);
+	ReleaseSemaphore(libav_jobs_semaphore, FFMIN(libav_numworkers, count - 1), NULL);
+
+	// help out and wait for the rest
+	LibAvW_DoJobs(&jobs);
+	WaitForSingleObject(libav_jobs_done, INFINITE);
+
+	// list goes away with this call, wait for workers still looking at it
+	EnterCriticalSection(&libav_jobs_current_lock);
+	libav_jobs_current = NULL;
+	LeaveCriticalSection(&libav_jobs_current_lock);
+	while(jobs.users > 0)
+		Sleep(0);
+	LeaveCriticalSection(&libav_jobs_lock);
 }
 
-// LibAvW_StreamGetError
-DLL_EXPORT int LibAvW_StreamGetError(void *stream)
-{
-	avwstream_t *s;
+/*
+=================================================================
 
-	// check
-	if (!libav_initialized)
-		return -1;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return -1;
+ Memory Accounting
 
-	return s->lasterror;
-}
+=================================================================
+*/
 
-// LibAvW_PlaySeekNextFrame
-DLL_EXPORT int LibAvW_PlaySeekNextFrame(void *stream)
+CRITICAL_SECTION  libav_memory_lock;
+avwmemorystats_t  libav_memory;
+
+// LibAvW_Memory_Add
+// adds bytes to stream and global counters
+void LibAvW_Memory_Add(avwstream_t *stream, int64_t *streamcounter, int64_t *globalcounter, int64_t bytes)
 {
-	avwstream_t *s;
-	int frame_finished = 0;
-	AVPacket pkt;
+	EnterCriticalSection(&libav_memory_lock);
+	*streamcounter += bytes;
+	*globalcounter += bytes;
+	stream->memory.total += bytes;
+	libav_memory.total += bytes;
+	LeaveCriticalSection(&libav_memory_lock);
+}
 
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+// LibAvW_Memory_AddGlobal
+// counts memory not held by any stream
+void LibAvW_Memory_AddGlobal(int64_t *globalcounter, int64_t bytes)
+{
+	EnterCriticalSection(&libav_memory_lock);
+	*globalcounter += bytes;
+	libav_memory.total += bytes;
+	LeaveCriticalSection(&libav_memory_lock);
+}
 
-	// read AV_InputFrame
-	av_init_packet(&pkt);
-	while(av_read_frame(s->AV_FormatContext, &pkt) >= 0)
-	{
-		// is this a packet from video stream
-		if (pkt.stream_index == s->AV_VideoStreamId)
-		{
-			// decode into AV_InputFrame
-			if (avcodec_decode_video2(s->AV_CodecContext, s->AV_InputFrame, &frame_finished, &pkt) < 0)
-			{
-				s->lasterror = LIBAVW_ERROR_DECODING_VIDEO_FRAME;
-				av_free_packet(&pkt);
-				return 0;
-			}
-			if (frame_finished)
-			{
-				// finished decoding a AV_InputFrame
-				s->framenum++;
-				s->lasterror = LIBAVW_ERROR_NONE;
-				av_free_packet(&pkt);
-				return 1;
-			}
-		}
-	}
-	av_free_packet(&pkt);
+// LibAvW_Memory_Fits
+// returns true if bytes can be allocated without going over memory limit
+bool LibAvW_Memory_Fits(int64_t bytes)
+{
+	bool fits;
 
-	// reached end of stream
-	s->lasterror = LIBAVW_ERROR_NONE;
-	return 0;
+	if (libav_memory_limit <= 0)
+		return true;
+	EnterCriticalSection(&libav_memory_lock);
+	fits = (libav_memory.total + bytes <= libav_memory_limit);
+	LeaveCriticalSection(&libav_memory_lock);
+	return fits;
 }
 
-// LibAvW_PlayGetFrameImage
-DLL_EXPORT int LibAvW_PlayGetFrameImage(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
-{
-	avwstream_t *s;
-	PixelFormat avpixelformat;
-	int avscaler;
+/*
+=================================================================
 
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+ Allocation Tracing
 
-	// get pixel format
-	if (pixel_format == LIBAVW_PIXEL_FORMAT_BGR)
-		avpixelformat = PIX_FMT_BGR24;
-	else if (pixel_format == LIBAVW_PIXEL_FORMAT_BGRA)
-		avpixelformat = PIX_FMT_BGRA;
-	else
-	{
-		s->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
-		return 0;
-	}
+ builds with LIBAVW_ALLOCTRACE defined count allocations made by the
+ wrapper, packets read from libav and scale contexts per API call
+ and per decoded frame, counters are kept per thread in TLS slots
 
-	// get scaler
-	if (scaler >= LIBAVW_SCALER_BILINEAR && scaler <= LIBAVW_SCALER_SPLINE)
-		avscaler = libav_scalers[scaler];
-	else
-	{
-		s->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
-		return 0;
-	}
+=================================================================
+*/
 
-	// get AV_InputFrame
-	avpicture_fill((AVPicture *)s->AV_OutputFrame, (uint8_t *)imagedata, avpixelformat, imagewidth, imageheight);
-	SwsContext *scale_context = sws_getCachedContext(NULL, s->AV_InputFrame->width, s->AV_InputFrame->height, (PixelFormat)s->AV_InputFrame->format, s->framewidth, s->frameheight, avpixelformat, avscaler, NULL, NULL, NULL); 
-	if (!scale_context)
-	{
-		s->lasterror = LIBAVW_ERROR_BAD_SCALER;
-		return 0;
-	}
-	if (!sws_scale(scale_context, s->AV_InputFrame->data, s->AV_InputFrame->linesize, 0, s->AV_InputFrame->height, s->AV_OutputFrame->data, s->AV_OutputFrame->linesize))
-	{
-		s->lasterror = LIBAVW_ERROR_APPLYING_SCALE;
-		sws_freeContext(scale_context); 
-		return 0;
-	}
+#ifdef LIBAVW_ALLOCTRACE
 
-	// allright
-	s->lasterror = LIBAVW_ERROR_NONE;
-	sws_freeContext(scale_context); 
-	return 1;
+typedef struct avwtracemark_s
+{
+	uintptr_t        allocs;
+	uintptr_t        bytes;
+}avwtracemark_t;
+
+DWORD             libav_trace_allocs = TLS_OUT_OF_INDEXES;
+DWORD             libav_trace_bytes = TLS_OUT_OF_INDEXES;
+avwallocstats_t   libav_allocstats;
+
+#define LIBAVW_TRACE_ALLOC(bytes)  LibAvW_Trace_Alloc(bytes)
+#define LIBAVW_TRACE_BEGIN(mark)   LibAvW_Trace_Mark(&mark)
+#define LIBAVW_TRACE_CALL(s, mark) LibAvW_Trace_Call(s, &mark)
+#define LIBAVW_TRACE_FRAME(s, mark) LibAvW_Trace_Frame(s, &mark)
+
+// LibAvW_Trace_Init
+void LibAvW_Trace_Init(void)
+{
+	libav_trace_allocs = TlsAlloc();
+	libav_trace_bytes = TlsAlloc();
+	memset(&libav_allocstats, 0, sizeof(libav_allocstats));
 }
 
-// IO wrapper
-int LibAvW_FS_Read(void *opaque, uint8_t *buf, int buf_size)
+// LibAvW_Trace_Alloc
+void LibAvW_Trace_Alloc(int64_t bytes)
 {
-	avwstream_t *s = (avwstream_t *)opaque;
-	return s->IO_Read(s->file, buf, buf_size);
+	if (libav_trace_allocs == TLS_OUT_OF_INDEXES || libav_trace_bytes == TLS_OUT_OF_INDEXES)
+		return;
+	TlsSetValue(libav_trace_allocs, (LPVOID)((uintptr_t)TlsGetValue(libav_trace_allocs) + 1));
+	TlsSetValue(libav_trace_bytes, (LPVOID)((uintptr_t)TlsGetValue(libav_trace_bytes) + (uintptr_t)bytes));
+	EnterCriticalSection(&libav_memory_lock);
+	libav_allocstats.allocs++;
+	libav_allocstats.bytes += bytes;
+	LeaveCriticalSection(&libav_memory_lock);
 }
 
-int64_t LibAvW_FS_Seek(void *opaque, int64_t pos, int whence)
+// LibAvW_Trace_Mark
+// remembers thread counters, deltas are unsigned so they survive wrap around
+void LibAvW_Trace_Mark(avwtracemark_t *mark)
 {
-	avwstream_t *s = (avwstream_t *)opaque;
+	mark->allocs = (uintptr_t)TlsGetValue(libav_trace_allocs);
+	mark->bytes = (uintptr_t)TlsGetValue(libav_trace_bytes);
+}
 
-	if (whence == AVSEEK_SIZE)
-	{
-		if (s->IO_SeekSize)
-			return s->IO_SeekSize(s->file);
-		return -1;
-	}
-	if (whence == AVSEEK_FORCE)
-		return -1;
+// LibAvW_Trace_Call
+// accounts allocations made since mark to API call of stream
+void LibAvW_Trace_Call(avwstream_t *stream, avwtracemark_t *mark)
+{
+	int64_t allocs, bytes;
 
-	return s->IO_Seek(s->file, pos, whence);
+	allocs = (uintptr_t)TlsGetValue(libav_trace_allocs) - mark->allocs;
+	bytes = (uintptr_t)TlsGetValue(libav_trace_bytes) - mark->bytes;
+	EnterCriticalSection(&libav_memory_lock);
+	stream->allocstats.calls++;
+	stream->allocstats.allocs += allocs;
+	stream->allocstats.bytes += bytes;
+	stream->allocstats.lastcall_allocs = allocs;
+	stream->allocstats.lastcall_bytes = bytes;
+	libav_allocstats.calls++;
+	libav_allocstats.lastcall_allocs = allocs;
+	libav_allocstats.lastcall_bytes = bytes;
+	LeaveCriticalSection(&libav_memory_lock);
 }
 
-// LibAvW_PlayVideo
-DLL_EXPORT int LibAvW_PlayVideo(void *stream, void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize)
+// LibAvW_Trace_Frame
+// accounts allocations made since mark to decoded frame of stream
+void LibAvW_Trace_Frame(avwstream_t *stream, avwtracemark_t *mark)
 {
-	avwstream_t *s;
-	unsigned char *inputbuf;
-	unsigned int i;
+	int64_t allocs, bytes;
 
-	// check
-	if (!libav_initialized)
-		return 0;
-	s = (avwstream_t *)stream;
-	if (!s)
-		return 0;
+	allocs = (uintptr_t)TlsGetValue(libav_trace_allocs) - mark->allocs;
+	bytes = (uintptr_t)TlsGetValue(libav_trace_bytes) - mark->bytes;
+	EnterCriticalSection(&libav_memory_lock);
+	stream->allocstats.frames++;
+	stream->allocstats.lastframe_allocs = allocs;
+	stream->allocstats.lastframe_bytes = bytes;
+	libav_allocstats.frames++;
+	libav_allocstats.lastframe_allocs = allocs;
+	libav_allocstats.lastframe_bytes = bytes;
+	LeaveCriticalSection(&libav_memory_lock);
+}
 
-	// reset stream
-	LibAvW_ResetStream(s);
+#else
 
-	// set I/O functions
+typedef struct avwtracemark_s
+{
+	int              unused;
+}avwtracemark_t;
+
+#define LIBAVW_TRACE_ALLOC(bytes)  ((void)0)
+#define LIBAVW_TRACE_BEGIN(mark)   (mark).unused = 0
+#define LIBAVW_TRACE_CALL(s, mark) (void)mark
+#define LIBAVW_TRACE_FRAME(s, mark) (void)mark
+
+#endif
+
+/*
+=================================================================
+
+ Pipeline Tracing
+
+ when enabled, spans of open, probe, read callback, demux, decode,
+ convert and seek are recorded per stream and thread into a ring
+ which is dumped as Chrome trace JSON (chrome://tracing, Perfetto)
+
+=================================================================
+*/
+
+#define LIBAVW_TRACE_EVENTS 16384 // power of two
+
+typedef struct avwtraceevent_s
+{
+	volatile LONG    sequence;           // index of event + 1 once written, 0 while writing
+	LONG             epoch;              // tracing session event belongs to
+	const char      *name;
+	void            *stream;
+	DWORD            thread;
+	int64_t          start;
+	int64_t          end;
+}avwtraceevent_t;
+
+volatile bool     libav_tracing = false;
+volatile LONG     libav_trace_next = 0;    // never reset, writers may still hold indices of last session
+volatile LONG     libav_trace_first = 0;   // first index of current session
+volatile LONG     libav_trace_epoch = 0;   // bumped when tracing is enabled, events of older sessions are stale
+int64_t           libav_trace_base = 0;
+avwtraceevent_t   libav_trace_events[LIBAVW_TRACE_EVENTS];
+
+// LibAvW_Span_Begin
+// returns start time of span, 0 if tracing is off
+int64_t LibAvW_Span_Begin(void)
+{
+	if (!libav_tracing)
+		return 0;
+	return LibAvW_Timer();
+}
+
+// LibAvW_Span_End
+// records span started with LibAvW_Span_Begin, oldest spans are overwritten
+void LibAvW_Span_End(const char *name, void *stream, int64_t start)
+{
+	avwtraceevent_t *e;
+	LONG index, epoch;
+
+	if (!start || !libav_tracing)
+		return;
+	epoch = libav_trace_epoch;
+	index = InterlockedIncrement(&libav_trace_next) - 1;
+	e = &libav_trace_events[index & (LIBAVW_TRACE_EVENTS - 1)];
+	InterlockedExchange(&e->sequence, 0);
+	e->epoch = epoch;
+	e->name = name;
+	e->stream = stream;
+	e->thread = GetCurrentThreadId();
+	e->start = start;
+	e->end = LibAvW_Timer();
+	InterlockedExchange(&e->sequence, index + 1);
+}
+
+/*
+=================================================================
+
+ Frame Buffer Pool
+
+ decoded pictures are allocated from size-bucketed free lists
+ shared by all streams instead of libavcodec default allocator
+
+=================================================================
+*/
+
+#define LIBAVW_POOL_BUCKETS     32
+#define LIBAVW_POOL_GRANULARITY 65536
+#define LIBAVW_POOL_MAXFREE     (64 * 1024 * 1024)
+
+typedef struct avwpoolbuffer_s
+{
+	unsigned char          *data;
+	int                     size;
+	volatile LONG           refcount;    // codec and frame handles holding the buffer
+	int                     held;        // bytes kept in global frame usage for frame handles
+	struct avwpoolbuffer_s *next;
+}avwpoolbuffer_t;
+
+typedef struct avwpoolbucket_s
+{
+	int              size;
+	avwpoolbuffer_t *free;
+}avwpoolbucket_t;
+
+CRITICAL_SECTION  libav_pool_lock;
+avwpoolbucket_t   libav_pool_buckets[LIBAVW_POOL_BUCKETS];
+avwpoolstats_t    libav_pool_stats;
+
+// LibAvW_Pool_Alloc
+// returns buffer of at least size bytes
+avwpoolbuffer_t *LibAvW_Pool_Alloc(int size)
+{
+	avwpoolbucket_t *bucket;
+	avwpoolbuffer_t *buf;
+	int i;
+
+	size = FFALIGN(size, LIBAVW_POOL_GRANULARITY);
+	EnterCriticalSection(&libav_pool_lock);
+	for (i = 0; i < LIBAVW_POOL_BUCKETS; i++)
+	{
+		bucket = &libav_pool_buckets[i];
+		if (bucket->size != size || !bucket->free)
+			continue;
+		buf = bucket->free;
+		bucket->free = buf->next;
+		buf->next = NULL;
+		buf->refcount = 1;
+		buf->held = 0;
+		libav_pool_stats.numfree--;
+		libav_pool_stats.freebytes -= size;
+		libav_pool_stats.hits++;
+		LeaveCriticalSection(&libav_pool_lock);
+		return buf;
+	}
+	libav_pool_stats.misses++;
+	LeaveCriticalSection(&libav_pool_lock);
+
+	// allocate new one
+	buf = (avwpoolbuffer_t *)malloc(sizeof(avwpoolbuffer_t));
+	if (!buf)
+		return NULL;
+	buf->data = (unsigned char *)av_malloc(size);
+	if (!buf->data)
+	{
+		free(buf);
+		return NULL;
+	}
+	buf->size = size;
+	buf->refcount = 1;
+	buf->held = 0;
+	buf->next = NULL;
+	LIBAVW_TRACE_ALLOC(size);
+	EnterCriticalSection(&libav_pool_lock);
+	libav_pool_stats.numbuffers++;
+	libav_pool_stats.allocated += size;
+	LeaveCriticalSection(&libav_pool_lock);
+	return buf;
+}
+
+// LibAvW_Pool_Ref
+// adds reference to buffer, it is returned to the pool when last reference is freed
+void LibAvW_Pool_Ref(avwpoolbuffer_t *buf)
+{
+	InterlockedIncrement(&buf->refcount);
+}
+
+// LibAvW_Pool_Free
+// drops reference, returns buffer to the pool, frees it if pool holds too much unused memory
+void LibAvW_Pool_Free(avwpoolbuffer_t *buf)
+{
+	avwpoolbucket_t *bucket;
+	int i;
+
+	if (InterlockedDecrement(&buf->refcount) > 0)
+		return;
+	if (buf->held)
+	{
+		EnterCriticalSection(&libav_memory_lock);
+		libav_memory.frames -= buf->held;
+		libav_memory.total -= buf->held;
+		LeaveCriticalSection(&libav_memory_lock);
+		buf->held = 0;
+	}
+	EnterCriticalSection(&libav_pool_lock);
+	if (libav_pool_stats.freebytes + buf->size <= LIBAVW_POOL_MAXFREE)
+	{
+		// find bucket of that size or an empty one
+		bucket = NULL;
+		for (i = 0; i < LIBAVW_POOL_BUCKETS; i++)
+		{
+			if (libav_pool_buckets[i].size == buf->size)
+			{
+				bucket = &libav_pool_buckets[i];
+				break;
+			}
+			if (!bucket && !libav_pool_buckets[i].free)
+				bucket = &libav_pool_buckets[i];
+		}
+		if (bucket)
+		{
+			bucket->size = buf->size;
+			buf->next = bucket->free;
+			bucket->free = buf;
+			libav_pool_stats.numfree++;
+			libav_pool_stats.freebytes += buf->size;
+			LeaveCriticalSection(&libav_pool_lock);
+			return;
+		}
+	}
+	libav_pool_stats.numbuffers--;
+	libav_pool_stats.allocated -= buf->size;
+	LeaveCriticalSection(&libav_pool_lock);
+	av_free(buf->data);
+	free(buf);
+}
+
+// LibAvW_Pool_Hold
+// keeps buffer in global frame usage until last reference is dropped (frame handles may outlive stream)
+void LibAvW_Pool_Hold(avwpoolbuffer_t *buf)
+{
+	if (buf->held)
+		return;
+	buf->held = buf->size;
+	EnterCriticalSection(&libav_memory_lock);
+	libav_memory.frames += buf->held;
+	libav_memory.total += buf->held;
+	LeaveCriticalSection(&libav_memory_lock);
+}
+
+// LibAvW_Pool_Release
+// drops stream reference to buffer counted in stream frame usage,
+// if frame handles still hold the buffer it is counted globally until they release it
+void LibAvW_Pool_Release(avwstream_t *stream, avwpoolbuffer_t *buf)
+{
+	if (buf->refcount > 1)
+		LibAvW_Pool_Hold(buf);
+	LibAvW_Memory_Add(stream, &stream->memory.frames, &libav_memory.frames, -buf->size);
+	LibAvW_Pool_Free(buf);
+}
+
+// LibAvW_Pool_Trim
+// frees all unused buffers
+void LibAvW_Pool_Trim(void)
+{
+	avwpoolbuffer_t *buf, *next;
+	int i;
+
+	EnterCriticalSection(&libav_pool_lock);
+	for (i = 0; i < LIBAVW_POOL_BUCKETS; i++)
+	{
+		for (buf = libav_pool_buckets[i].free; buf; buf = next)
+		{
+			next = buf->next;
+			libav_pool_stats.numbuffers--;
+			libav_pool_stats.allocated -= buf->size;
+			av_free(buf->data);
+			free(buf);
+		}
+		libav_pool_buckets[i].free = NULL;
+	}
+	libav_pool_stats.numfree = 0;
+	libav_pool_stats.freebytes = 0;
+	LeaveCriticalSection(&libav_pool_lock);
+}
+
+// LibAvW_GetBuffer
+// AVCodecContext.get_buffer
+int LibAvW_GetBuffer(AVCodecContext *c, AVFrame *pic)
+{
+	const AVPixFmtDescriptor *desc;
+	avwpoolbuffer_t *buf;
+	uint8_t *data[4];
+	int linesize[4], stride_align[AV_NUM_DATA_POINTERS];
+	int i, w, h, edge, size, pixel_size, h_shift, v_shift, unaligned;
+
+	desc = av_pix_fmt_desc_get(c->pix_fmt);
+	if (!desc || (desc->flags & PIX_FMT_HWACCEL) || av_image_check_size(c->width, c->height, 0, c) < 0)
+		return avcodec_default_get_buffer(c, pic);
+
+	// get aligned plane sizes same way avcodec_default_get_buffer does
+	w = c->width;
+	h = c->height;
+	avcodec_align_dimensions2(c, &w, &h, stride_align);
+	edge = (c->flags & CODEC_FLAG_EMU_EDGE) ? 0 : avcodec_get_edge_width();
+	w += edge * 2;
+	h += edge * 2;
+	do
+	{
+		av_image_fill_linesizes(linesize, c->pix_fmt, w);
+		w += w & ~(w - 1);
+		unaligned = 0;
+		for (i = 0; i < 4; i++)
+			unaligned |= linesize[i] % stride_align[i];
+	} while(unaligned);
+	size = av_image_fill_pointers(data, c->pix_fmt, h, NULL, linesize);
+	if (size < 0)
+		return avcodec_default_get_buffer(c, pic);
+
+	// get buffer and fill planes
+	buf = LibAvW_Pool_Alloc(size + 16 + 64);
+	if (!buf)
+		return -1;
+	av_image_fill_pointers(data, c->pix_fmt, h, buf->data, linesize);
+	LibAvW_Memory_Add((avwstream_t *)c->opaque, &((avwstream_t *)c->opaque)->memory.frames, &libav_memory.frames, buf->size);
+	pixel_size = desc->comp[0].step_minus1 + 1;
+	for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+	{
+		pic->base[i] = NULL;
+		pic->data[i] = NULL;
+		pic->linesize[i] = 0;
+	}
+	for (i = 0; i < 4 && data[i]; i++)
+	{
+		h_shift = (i == 1 || i == 2) ? desc->log2_chroma_w : 0;
+		v_shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+		pic->base[i] = data[i];
+		pic->linesize[i] = linesize[i];
+		if ((desc->flags & PIX_FMT_PAL) && i == 1)
+			pic->data[i] = data[i];
+		else
+			pic->data[i] = data[i] + FFALIGN((linesize[i] * edge >> v_shift) + (pixel_size * edge >> h_shift), stride_align[i]);
+	}
+	pic->extended_data = pic->data;
+	pic->type = FF_BUFFER_TYPE_USER;
+	pic->opaque = buf;
+	pic->pkt_pts = c->pkt ? c->pkt->pts : AV_NOPTS_VALUE;
+	pic->reordered_opaque = c->reordered_opaque;
+	pic->width = c->width;
+	pic->height = c->height;
+	pic->format = c->pix_fmt;
+	pic->sample_aspect_ratio = c->sample_aspect_ratio;
+	return 0;
+}
+
+// LibAvW_ReleaseBuffer
+// AVCodecContext.release_buffer
+void LibAvW_ReleaseBuffer(AVCodecContext *c, AVFrame *pic)
+{
+	int i;
+
+	if (pic->type != FF_BUFFER_TYPE_USER)
+	{
+		avcodec_default_release_buffer(c, pic);
+		return;
+	}
+	if (pic->opaque)
+		LibAvW_Pool_Release((avwstream_t *)c->opaque, (avwpoolbuffer_t *)pic->opaque);
+	pic->opaque = NULL;
+	for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+	{
+		pic->base[i] = NULL;
+		pic->data[i] = NULL;
+	}
+}
+
+/*
+=================================================================
+
+ Reverse Playback Buffers
+
+=================================================================
+*/
+
+#define LIBAVW_REVERSE_MAXFRAMES 64
+#define LIBAVW_REVERSE_MAXBYTES  (64 * 1024 * 1024)
+
+// decoded frame copy
+typedef struct avwrevframe_s
+{
+	avwpoolbuffer_t *buf;
+	AVPicture        picture;
+	PixelFormat      format;
+	int              width;
+	int              height;
+	double           pts;
+	double           duration;
+}avwrevframe_t;
+
+// frames of one GOP in decoding order
+typedef struct avwrevgop_s
+{
+	avwrevframe_t    frames[LIBAVW_REVERSE_MAXFRAMES];
+	int              numframes;
+	double           startpts;
+}avwrevgop_t;
+
+// LibAvW_Reverse_FreeGOP
+void LibAvW_Reverse_FreeGOP(avwstream_t *stream, avwrevgop_t *gop)
+{
+	int i;
+
+	for (i = 0; i < gop->numframes; i++)
+		LibAvW_Pool_Release(stream, gop->frames[i].buf);
+	gop->numframes = 0;
+}
+
+// LibAvW_Reverse_Stop
+// stops prefetch thread and frees reverse playback buffers
+void LibAvW_Reverse_Stop(avwstream_t *stream)
+{
+	if (stream->rev_thread)
+	{
+		stream->rev_quit = true;
+		SetEvent(stream->rev_wake);
+		WaitForSingleObject(stream->rev_thread, INFINITE);
+		CloseHandle(stream->rev_thread);
+		CloseHandle(stream->rev_wake);
+		CloseHandle(stream->rev_filled);
+	}
+	stream->rev_thread = NULL;
+	stream->rev_wake = NULL;
+	stream->rev_filled = NULL;
+	stream->rev_quit = false;
+	stream->rev_pending = false;
+	if (stream->rev_front)
+	{
+		LibAvW_Reverse_FreeGOP(stream, stream->rev_front);
+		free(stream->rev_front);
+	}
+	if (stream->rev_back)
+	{
+		LibAvW_Reverse_FreeGOP(stream, stream->rev_back);
+		free(stream->rev_back);
+	}
+	stream->rev_front = NULL;
+	stream->rev_back = NULL;
+	stream->rev_current = NULL;
+	stream->rev_pos = -1;
+	stream->reverse = false;
+}
+
+/*
+=================================================================
+
+ Frame Cache
+
+=================================================================
+*/
+
+CRITICAL_SECTION  libav_streams_lock;
+avwstream_t      *libav_streams;
+
+// LibAvW_Cache_Free
+// frees cached frames, cache budget is a stream setting and is kept
+void LibAvW_Cache_Free(avwstream_t *stream)
+{
+	int i;
+
+	EnterCriticalSection(&stream->cache_lock);
+	if (stream->cache_frames)
+	{
+		for (i = 0; i < stream->cache_maxframes; i++)
+			if (stream->cache_frames[i])
+				free(stream->cache_frames[i]);
+		free(stream->cache_frames);
+	}
+	LibAvW_Memory_Add(stream, &stream->memory.caches, &libav_memory.caches, -stream->cache_size);
+	stream->cache_frames = NULL;
+	stream->cache_maxframes = 0;
+	stream->cache_numframes = 0;
+	stream->cache_size = 0;
+	stream->cache_imagesize = 0;
+	stream->cache_playing = false;
+	LeaveCriticalSection(&stream->cache_lock);
+}
+
+// LibAvW_Cache_Complete
+// returns true if every frame of the stream is in the cache
+bool LibAvW_Cache_Complete(avwstream_t *stream)
+{
+	int i;
+
+	if (stream->cache_budget <= 0 || stream->cache_overflow || stream->cache_numframes <= 0)
+		return false;
+	if (stream->cache_numframes > stream->cache_maxframes)
+		return false;
+	for (i = 0; i < stream->cache_numframes; i++)
+		if (!stream->cache_frames[i])
+			return false;
+	return true;
+}
+
+// LibAvW_Cache_GetFrame
+// returns cached image for current frame or NULL
+unsigned char *LibAvW_Cache_GetFrame(avwstream_t *stream)
+{
+	if (stream->disk_view)
+	{
+		if (stream->framenum <= 0 || stream->framenum > stream->cache_numframes)
+			return NULL;
+		return stream->disk_view + LIBAVW_DISKCACHE_HEADER + (size_t)(stream->framenum - 1) * stream->cache_imagesize;
+	}
+	if (stream->cache_budget <= 0 || stream->cache_overflow)
+		return NULL;
+	if (stream->framenum <= 0 || stream->framenum > stream->cache_maxframes)
+		return NULL;
+	return stream->cache_frames[stream->framenum - 1];
+}
+
+// LibAvW_Cache_StoreFrame
+// stores converted image of current frame, drops the cache if budget is exceeded
+void LibAvW_Cache_StoreFrame(avwstream_t *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler, bool autoscale, int imagesize)
+{
+	unsigned char **frames;
+	unsigned char *image;
+	int index, maxframes;
+
+	if (stream->cache_budget <= 0 || stream->cache_overflow || stream->cache_playing)
+		return;
+	index = (int)stream->framenum - 1;
+	if (index < 0)
+		return;
+
+	// engine changed output settings, start over
+	// (automatic scaler steps between quality levels while cache fills, cache keeps scaler of its first frame)
+	if (stream->cache_size > 0 && (stream->cache_pixelformat != pixel_format || stream->cache_width != imagewidth || stream->cache_height != imageheight || (stream->cache_scaler != scaler && !autoscale)))
+		LibAvW_Cache_Free(stream);
+	stream->cache_pixelformat = pixel_format;
+	stream->cache_width = imagewidth;
+	stream->cache_height = imageheight;
+	if (!stream->cache_size || !autoscale)
+		stream->cache_scaler = scaler;
+	stream->cache_imagesize = imagesize;
+
+	// check budget
+	if (index < stream->cache_maxframes && stream->cache_frames[index])
+		return;
+	if (stream->cache_size + imagesize > stream->cache_budget || !LibAvW_Memory_Fits(imagesize))
+	{
+		LibAvW_Cache_Free(stream);
+		stream->cache_overflow = true;
+		return;
+	}
+
+	// grow frame table
+	if (index >= stream->cache_maxframes)
+	{
+		maxframes = FFMAX(index + 1, stream->cache_maxframes * 2);
+		frames = (unsigned char **)realloc(stream->cache_frames, sizeof(unsigned char *) * maxframes);
+		if (!frames)
+			return;
+		memset(frames + stream->cache_maxframes, 0, sizeof(unsigned char *) * (maxframes - stream->cache_maxframes));
+		stream->cache_frames = frames;
+		stream->cache_maxframes = maxframes;
+	}
+
+	// store
+	image = (unsigned char *)malloc(imagesize);
+	if (!image)
+		return;
+	LIBAVW_TRACE_ALLOC(imagesize);
+	memcpy(image, imagedata, imagesize);
+	stream->cache_frames[index] = image;
+	stream->cache_size += imagesize;
+	LibAvW_Memory_Add(stream, &stream->memory.caches, &libav_memory.caches, imagesize);
+}
+
+// LibAvW_Cache_DropOthers
+// frees caches other streams are still filling to make room for a new stream,
+// caches streams play from are kept as their decoders are bypassed
+void LibAvW_Cache_DropOthers(avwstream_t *stream)
+{
+	avwstream_t *s;
+
+	EnterCriticalSection(&libav_streams_lock);
+	for (s = libav_streams; s; s = s->next)
+	{
+		if (s == stream)
+			continue;
+		EnterCriticalSection(&s->cache_lock);
+		if (s->cache_size > 0 && !s->cache_playing)
+		{
+			LibAvW_Cache_Free(s);
+			s->cache_overflow = true;
+		}
+		LeaveCriticalSection(&s->cache_lock);
+	}
+	LeaveCriticalSection(&libav_streams_lock);
+}
+
+/*
+=================================================================
+
+ Disk Frame Cache
+
+ converted frames of first playback of an identified file are
+ written to a cache file, later opens map it and play from it
+ like from a complete frame cache, without decoding
+
+=================================================================
+*/
+
+// LibAvW_Disk_Close
+// unmaps cache file, unfinished cache file is deleted
+void LibAvW_Disk_Close(avwstream_t *stream)
+{
+	char temp[MAX_PATH + 8];
+
+	if (stream->disk_view)
+	{
+		UnmapViewOfFile(stream->disk_view);
+		CloseHandle(stream->disk_mapping);
+		stream->disk_view = NULL;
+		stream->disk_mapping = NULL;
+		LibAvW_Cache_Free(stream);
+	}
+	if (stream->disk_file)
+	{
+		CloseHandle(stream->disk_file);
+		stream->disk_file = NULL;
+		_snprintf(temp, sizeof(temp), "%s.tmp", stream->disk_path);
+		DeleteFileA(temp);
+	}
+	stream->disk_written = 0;
+}
+
+// LibAvW_Disk_Map
+// maps complete cache file of current file and starts playing from it
+bool LibAvW_Disk_Map(avwstream_t *stream)
+{
+	avwdiskheader_t *header;
+	LARGE_INTEGER size;
+	HANDLE file, mapping;
+	unsigned char *view;
+
+	if (stream->disk_view)
+		return true;
+	if (!stream->disk_path[0] || !stream->identity[0] || stream->disk_file || stream->reverse)
+		return false;
+	file = CreateFileA(stream->disk_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	mapping = NULL;
+	view = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart >= LIBAVW_DISKCACHE_HEADER)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping)
+		view = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(file); // mapping keeps it open
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		return false;
+	}
+
+	// cache of other file, other settings or unfinished
+	header = (avwdiskheader_t *)view;
+	if (memcmp(header->magic, "AVWC", 4) || header->version != LIBAVW_DISKCACHE_VERSION || header->identity[LIBAVW_MAX_IDENTITY - 1] || strcmp(header->identity, stream->identity) || header->alphamode != stream->alphamode
+	 || header->pixelformat != stream->disk_pixelformat || header->width != stream->disk_width || header->height != stream->disk_height || (header->scaler != stream->disk_scaler && stream->disk_scaler != LIBAVW_SCALER_AUTO)
+	 || header->numframes <= 0 || header->imagesize <= 0 || header->imagesize != avpicture_get_size(LibAvW_GetPixelFormat(header->pixelformat), header->width, header->height)
+	 || size.QuadPart < LIBAVW_DISKCACHE_HEADER + (int64_t)header->numframes * header->imagesize)
+	{
+		UnmapViewOfFile(view);
+		CloseHandle(mapping);
+		return false;
+	}
+
+	// heap copies are no longer needed
+	LibAvW_Cache_Free(stream);
+	stream->disk_mapping = mapping;
+	stream->disk_view = view;
+	stream->cache_pixelformat = header->pixelformat;
+	stream->cache_width = header->width;
+	stream->cache_height = header->height;
+	stream->cache_scaler = header->scaler;
+	stream->cache_imagesize = header->imagesize;
+	stream->cache_numframes = header->numframes;
+	stream->cache_playing = true;
+	stream->framenum = 0;
+	return true;
+}
+
+// LibAvW_Disk_Abandon
+// stops writing cache file until stream reset
+void LibAvW_Disk_Abandon(avwstream_t *stream)
+{
+	LibAvW_Disk_Close(stream);
+	stream->disk_finished = true;
+}
+
+// LibAvW_Disk_StoreFrame
+// appends converted image of current frame to cache file, only a plain first pass makes a usable one
+void LibAvW_Disk_StoreFrame(avwstream_t *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler, int imagesize)
+{
+	avwdiskheader_t *header = &stream->disk_header;
+	char temp[MAX_PATH + 8];
+	DWORD written;
+
+	if (!stream->disk_path[0] || !stream->identity[0] || stream->disk_view || stream->disk_finished)
+		return;
+
+	// first frame starts cache file, engine must be converting with settings cache file is for
+	if (!stream->disk_file)
+	{
+		if (stream->framenum != 1)
+			return;
+		if (pixel_format != stream->disk_pixelformat || imagewidth != stream->disk_width || imageheight != stream->disk_height || (scaler != stream->disk_scaler && stream->disk_scaler != LIBAVW_SCALER_AUTO))
+			return;
+		_snprintf(temp, sizeof(temp), "%s.tmp", stream->disk_path);
+		stream->disk_file = CreateFileA(temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (stream->disk_file == INVALID_HANDLE_VALUE)
+		{
+			stream->disk_file = NULL;
+			stream->disk_finished = true;
+			return;
+		}
+		memset(header, 0, sizeof(avwdiskheader_t));
+		memcpy(header->magic, "AVWC", 4);
+		header->version = LIBAVW_DISKCACHE_VERSION;
+		strcpy(header->identity, stream->identity);
+		header->alphamode = stream->alphamode;
+		header->pixelformat = pixel_format;
+		header->width = imagewidth;
+		header->height = imageheight;
+		header->scaler = scaler;
+		header->imagesize = imagesize;
+		stream->disk_written = 0;
+		if (SetFilePointer(stream->disk_file, LIBAVW_DISKCACHE_HEADER, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+		{
+			LibAvW_Disk_Abandon(stream);
+			return;
+		}
+	}
+
+	// same frame again
+	if (stream->framenum == stream->disk_written)
+		return;
+
+	// skipped or reordered frames, changed settings
+	if (stream->framenum != stream->disk_written + 1 || header->pixelformat != pixel_format || header->width != imagewidth || header->height != imageheight || header->alphamode != stream->alphamode)
+	{
+		LibAvW_Disk_Abandon(stream);
+		return;
+	}
+	if (!WriteFile(stream->disk_file, imagedata, imagesize, &written, NULL) || written != (DWORD)imagesize)
+	{
+		LibAvW_Disk_Abandon(stream);
+		return;
+	}
+	stream->disk_written++;
+}
+
+// LibAvW_Disk_Finish
+// completes cache file when first pass reached end of stream
+void LibAvW_Disk_Finish(avwstream_t *stream)
+{
+	char temp[MAX_PATH + 8];
+	DWORD written;
+	bool ok;
+
+	if (!stream->disk_file)
+		return;
+	if (stream->disk_written != stream->framenum)
+	{
+		LibAvW_Disk_Abandon(stream);
+		return;
+	}
+	stream->disk_header.numframes = stream->disk_written;
+	ok = (SetFilePointer(stream->disk_file, 0, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER);
+	if (ok)
+		ok = (WriteFile(stream->disk_file, &stream->disk_header, sizeof(avwdiskheader_t), &written, NULL) && written == sizeof(avwdiskheader_t));
+	CloseHandle(stream->disk_file);
+	stream->disk_file = NULL;
+	stream->disk_written = 0;
+	stream->disk_finished = true;
+
+	// cache file appears complete or not at all
+	_snprintf(temp, sizeof(temp), "%s.tmp", stream->disk_path);
+	if (!ok || !MoveFileExA(temp, stream->disk_path, MOVEFILE_REPLACE_EXISTING))
+		DeleteFileA(temp);
+}
+
+/*
+=================================================================
+
+ Probe Cache
+
+=================================================================
+*/
+
+#define LIBAVW_PROBECACHE_SIZE    32
+#define LIBAVW_PROBECACHE_STREAMS 8
+
+// stream parameters found by avformat_find_stream_info
+typedef struct avwprobestream_s
+{
+	int              codec_type;
+	int              codec_id;
+	int              width;
+	int              height;
+	int              pix_fmt;
+	int              has_b_frames;
+	int              bit_rate;
+	int              sample_rate;
+	int              channels;
+	int              sample_fmt;
+	AVRational       sample_aspect_ratio;
+	AVRational       avg_frame_rate;
+	AVRational       r_frame_rate;
+	int64_t          start_time;
+	int64_t          duration;
+	int64_t          nb_frames;
+	uint8_t         *extradata;
+	int              extradata_size;
+}avwprobestream_t;
+
+typedef struct avwprobeentry_s
+{
+	char             identity[LIBAVW_MAX_IDENTITY];
+	AVInputFormat   *iformat;
+	int64_t          start_time;
+	int64_t          duration;
+	int              bit_rate;
+	unsigned int     nb_streams;
+	avwprobestream_t streams[LIBAVW_PROBECACHE_STREAMS];
+	unsigned int     lastused;
+}avwprobeentry_t;
+
+avwprobeentry_t   libav_probecache[LIBAVW_PROBECACHE_SIZE];
+unsigned int      libav_probecache_counter = 0;
+CRITICAL_SECTION  libav_probecache_lock;
+
+// LibAvW_Probe_FreeEntry
+void LibAvW_Probe_FreeEntry(avwprobeentry_t *e)
+{
+	unsigned int i;
+
+	for (i = 0; i < e->nb_streams; i++)
+		if (e->streams[i].extradata)
+			av_free(e->streams[i].extradata);
+	memset(e, 0, sizeof(avwprobeentry_t));
+}
+
+// LibAvW_Probe_Find
+// returns entry for identity, must be called with probe cache lock held
+avwprobeentry_t *LibAvW_Probe_Find(const char *identity)
+{
+	int i;
+
+	for (i = 0; i < LIBAVW_PROBECACHE_SIZE; i++)
+		if (libav_probecache[i].iformat && !strcmp(libav_probecache[i].identity, identity))
+			return &libav_probecache[i];
+	return NULL;
+}
+
+// LibAvW_Probe_Store
+// remembers probed parameters of opened format context under identity
+void LibAvW_Probe_Store(const char *identity, AVFormatContext *fmt)
+{
+	avwprobeentry_t *e;
+	avwprobestream_t *ps;
+	AVStream *st;
+	unsigned int i;
+
+	if (!identity[0] || !fmt->iformat || fmt->nb_streams > LIBAVW_PROBECACHE_STREAMS)
+		return;
+	EnterCriticalSection(&libav_probecache_lock);
+	e = LibAvW_Probe_Find(identity);
+	if (!e)
+	{
+		// replace least recently used entry
+		e = &libav_probecache[0];
+		for (i = 1; i < LIBAVW_PROBECACHE_SIZE; i++)
+			if (libav_probecache[i].lastused < e->lastused)
+				e = &libav_probecache[i];
+	}
+	LibAvW_Probe_FreeEntry(e);
+	strncpy(e->identity, identity, LIBAVW_MAX_IDENTITY - 1);
+	e->iformat = fmt->iformat;
+	e->start_time = fmt->start_time;
+	e->duration = fmt->duration;
+	e->bit_rate = fmt->bit_rate;
+	e->nb_streams = fmt->nb_streams;
+	e->lastused = ++libav_probecache_counter;
+	for (i = 0; i < fmt->nb_streams; i++)
+	{
+		st = fmt->streams[i];
+		ps = &e->streams[i];
+		ps->codec_type = st->codec->codec_type;
+		ps->codec_id = st->codec->codec_id;
+		ps->width = st->codec->width;
+		ps->height = st->codec->height;
+		ps->pix_fmt = st->codec->pix_fmt;
+		ps->has_b_frames = st->codec->has_b_frames;
+		ps->bit_rate = st->codec->bit_rate;
+		ps->sample_rate = st->codec->sample_rate;
+		ps->channels = st->codec->channels;
+		ps->sample_fmt = st->codec->sample_fmt;
+		ps->sample_aspect_ratio = st->sample_aspect_ratio;
+		ps->avg_frame_rate = st->avg_frame_rate;
+		ps->r_frame_rate = st->r_frame_rate;
+		ps->start_time = st->start_time;
+		ps->duration = st->duration;
+		ps->nb_frames = st->nb_frames;
+		if (st->codec->extradata && st->codec->extradata_size > 0)
+		{
+			ps->extradata = (uint8_t *)av_mallocz(st->codec->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+			if (ps->extradata)
+			{
+				memcpy(ps->extradata, st->codec->extradata, st->codec->extradata_size);
+				ps->extradata_size = st->codec->extradata_size;
+			}
+		}
+	}
+	LeaveCriticalSection(&libav_probecache_lock);
+}
+
+// LibAvW_Probe_Restore
+// fills opened format context with parameters of identity, returns false if there are none
+// or stream layout found by demuxer differs from cached one
+bool LibAvW_Probe_Restore(const char *identity, AVFormatContext *fmt)
+{
+	avwprobeentry_t *e;
+	avwprobestream_t *ps;
+	AVCodecContext *codec;
+	AVStream *st;
+	unsigned int i;
+
+	if (!identity[0])
+		return false;
+	EnterCriticalSection(&libav_probecache_lock);
+	e = LibAvW_Probe_Find(identity);
+	if (!e || e->iformat != fmt->iformat || e->nb_streams != fmt->nb_streams)
+	{
+		LeaveCriticalSection(&libav_probecache_lock);
+		return false;
+	}
+	for (i = 0; i < fmt->nb_streams; i++)
+	{
+		if ((int)fmt->streams[i]->codec->codec_type != e->streams[i].codec_type || (int)fmt->streams[i]->codec->codec_id != e->streams[i].codec_id)
+		{
+			LeaveCriticalSection(&libav_probecache_lock);
+			return false;
+		}
+	}
+	for (i = 0; i < fmt->nb_streams; i++)
+	{
+		st = fmt->streams[i];
+		codec = st->codec;
+		ps = &e->streams[i];
+		codec->width = ps->width;
+		codec->height = ps->height;
+		codec->pix_fmt = (PixelFormat)ps->pix_fmt;
+		codec->has_b_frames = ps->has_b_frames;
+		if (!codec->bit_rate)
+			codec->bit_rate = ps->bit_rate;
+		if (!codec->sample_rate)
+			codec->sample_rate = ps->sample_rate;
+		if (!codec->channels)
+			codec->channels = ps->channels;
+		if (codec->sample_fmt == AV_SAMPLE_FMT_NONE)
+			codec->sample_fmt = (AVSampleFormat)ps->sample_fmt;
+		if (!codec->extradata && ps->extradata)
+		{
+			codec->extradata = (uint8_t *)av_mallocz(ps->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+			if (codec->extradata)
+			{
+				memcpy(codec->extradata, ps->extradata, ps->extradata_size);
+				codec->extradata_size = ps->extradata_size;
+			}
+		}
+		st->sample_aspect_ratio = ps->sample_aspect_ratio;
+		st->avg_frame_rate = ps->avg_frame_rate;
+		st->r_frame_rate = ps->r_frame_rate;
+		if (st->start_time == (int64_t)AV_NOPTS_VALUE)
+			st->start_time = ps->start_time;
+		if (st->duration == (int64_t)AV_NOPTS_VALUE)
+			st->duration = ps->duration;
+		if (!st->nb_frames)
+			st->nb_frames = ps->nb_frames;
+	}
+	if (fmt->start_time == (int64_t)AV_NOPTS_VALUE)
+		fmt->start_time = e->start_time;
+	if (fmt->duration == (int64_t)AV_NOPTS_VALUE)
+		fmt->duration = e->duration;
+	if (!fmt->bit_rate)
+		fmt->bit_rate = e->bit_rate;
+	e->lastused = ++libav_probecache_counter;
+	LeaveCriticalSection(&libav_probecache_lock);
+	return true;
+}
+
+// LibAvW_Probe_Format
+// returns demuxer cached for identity so probing can be skipped
+AVInputFormat *LibAvW_Probe_Format(const char *identity)
+{
+	avwprobeentry_t *e;
+	AVInputFormat *iformat;
+
+	if (!identity[0])
+		return NULL;
+	EnterCriticalSection(&libav_probecache_lock);
+	e = LibAvW_Probe_Find(identity);
+	iformat = e ? e->iformat : NULL;
+	LeaveCriticalSection(&libav_probecache_lock);
+	return iformat;
+}
+
+/*
+=================================================================
+
+ Demux Thread
+
+ in pipelined mode packets are read ahead on a separate thread into
+ bounded per-stream queues, decoding pulls video packets from them
+
+=================================================================
+*/
+
+#define LIBAVW_QUEUE_VIDEO_BYTES (8 * 1024 * 1024)
+#define LIBAVW_QUEUE_AUDIO_BYTES (1 * 1024 * 1024)
+#define LIBAVW_QUEUE_DURATION    2.0  // seconds
+
+// LibAvW_Queue_Push
+// takes ownership of packet, must be called with demux lock held
+bool LibAvW_Queue_Push(avwstream_t *stream, avwpacketqueue_t *queue, AVPacket *pkt, double duration)
+{
+	avwpacketnode_t *node;
+
+	node = (avwpacketnode_t *)av_malloc(sizeof(avwpacketnode_t));
+	if (!node)
+		return false;
+	LIBAVW_TRACE_ALLOC(sizeof(avwpacketnode_t));
+	node->pkt = *pkt;
+	node->next = NULL;
+	if (queue->last)
+		queue->last->next = node;
+	else
+		queue->first = node;
+	queue->last = node;
+	queue->numpackets++;
+	queue->bytes += pkt->size;
+	queue->duration += duration;
+	LibAvW_Memory_Add(stream, &stream->memory.packets, &libav_memory.packets, pkt->size);
+	return true;
+}
+
+// LibAvW_Queue_Pop
+// must be called with demux lock held (or with demux thread stopped)
+bool LibAvW_Queue_Pop(avwstream_t *stream, avwpacketqueue_t *queue, AVPacket *pkt, double *duration)
+{
+	avwpacketnode_t *node;
+	AVStream *st;
+	double d;
+
+	node = queue->first;
+	if (!node)
+		return false;
+	queue->first = node->next;
+	if (!queue->first)
+		queue->last = NULL;
+	*pkt = node->pkt;
+	av_free(node);
+	st = stream->AV_FormatContext->streams[pkt->stream_index];
+	d = pkt->duration * av_q2d(st->time_base);
+	if (duration)
+		*duration = d;
+	queue->numpackets--;
+	queue->bytes -= pkt->size;
+	queue->duration = FFMAX(0, queue->duration - d);
+	LibAvW_Memory_Add(stream, &stream->memory.packets, &libav_memory.packets, -pkt->size);
+	return true;
+}
+
+// LibAvW_Queue_Flush
+void LibAvW_Queue_Flush(avwstream_t *stream, avwpacketqueue_t *queue)
+{
+	AVPacket pkt;
+
+	while(LibAvW_Queue_Pop(stream, queue, &pkt, NULL))
+		av_free_packet(&pkt);
+	queue->duration = 0;
+	queue->eof = false;
+}
+
+// LibAvW_Queue_Full
+bool LibAvW_Queue_Full(avwpacketqueue_t *queue)
+{
+	return queue->bytes >= queue->maxbytes || queue->duration >= LIBAVW_QUEUE_DURATION;
+}
+
+// LibAvW_DemuxThread
+unsigned int __stdcall LibAvW_DemuxThread(void *arg)
+{
+	avwstream_t *stream = (avwstream_t *)arg;
+	avwpacketqueue_t *queue;
+	AVStream *st;
+	AVPacket pkt, old;
+	double duration;
+	int64_t span;
+	bool full;
+	int ret;
+
+	while(!stream->demux_quit)
+	{
+		// wait for decoder to catch up
+		EnterCriticalSection(&stream->demux_lock);
+		full = LibAvW_Queue_Full(&stream->videoqueue);
+		LeaveCriticalSection(&stream->demux_lock);
+		if (full)
+		{
+			WaitForSingleObject(stream->demux_space, INFINITE);
+			continue;
+		}
+
+		// read packet
+		av_init_packet(&pkt);
+		span = LibAvW_Span_Begin();
+		ret = av_read_frame(stream->AV_FormatContext, &pkt);
+		LibAvW_Span_End("demux", stream, span);
+		if (ret < 0 && stream->demux_quit)
+			break; // read was abandoned by Demux_Stop, not end of file
+		if (ret < 0)
+		{
+			EnterCriticalSection(&stream->demux_lock);
+			stream->videoqueue.eof = true;
+			stream->audioqueue.eof = true;
+			LeaveCriticalSection(&stream->demux_lock);
+			SetEvent(stream->demux_data);
+			break;
+		}
+		if (pkt.stream_index == stream->AV_VideoStreamId)
+			queue = &stream->videoqueue;
+		else if (pkt.stream_index == stream->AV_AudioStreamId)
+			queue = &stream->audioqueue;
+		else
+		{
+			av_free_packet(&pkt);
+			continue;
+		}
+
+		// queued packet must own its data
+		// (data is allocated either by demuxer or by av_dup_packet)
+		if (av_dup_packet(&pkt) < 0)
+		{
+			av_free_packet(&pkt);
+			continue;
+		}
+		LIBAVW_TRACE_ALLOC(pkt.size);
+		st = stream->AV_FormatContext->streams[pkt.stream_index];
+		if (!pkt.duration && queue == &stream->videoqueue && stream->framerate > 0)
+			pkt.duration = (int)(1.0 / (stream->framerate * av_q2d(st->time_base)) + 0.5);
+		duration = pkt.duration * av_q2d(st->time_base);
+		EnterCriticalSection(&stream->demux_lock);
+		while(queue == &stream->audioqueue && LibAvW_Queue_Full(queue) && LibAvW_Queue_Pop(stream, queue, &old, NULL))
+			av_free_packet(&old);
+		if (!LibAvW_Queue_Push(stream, queue, &pkt, duration))
+			av_free_packet(&pkt);
+		LeaveCriticalSection(&stream->demux_lock);
+		SetEvent(stream->demux_data);
+	}
+	return 0;
+}
+
+// LibAvW_Demux_Start
+// starts reading ahead from current demuxer position
+void LibAvW_Demux_Start(avwstream_t *stream)
+{
+	if (!stream->pipelined || stream->demux_thread || !stream->AV_FormatContext || stream->AV_VideoStreamId < 0 || !stream->AV_Codec)
+		return;
+	stream->videoqueue.maxbytes = LIBAVW_QUEUE_VIDEO_BYTES;
+	stream->audioqueue.maxbytes = LIBAVW_QUEUE_AUDIO_BYTES;
+	stream->videoqueue.eof = false;
+	stream->audioqueue.eof = false;
+	stream->demux_quit = false;
+	stream->demux_data = CreateEvent(NULL, FALSE, FALSE, NULL);
+	stream->demux_space = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (stream->demux_data && stream->demux_space)
+		stream->demux_thread = (HANDLE)_beginthreadex(NULL, 0, LibAvW_DemuxThread, stream, 0, NULL);
+	if (!stream->demux_thread)
+	{
+		// stay with reading on decoding thread
+		if (stream->demux_data)
+			CloseHandle(stream->demux_data);
+		if (stream->demux_space)
+			CloseHandle(stream->demux_space);
+		stream->demux_data = NULL;
+		stream->demux_space = NULL;
+	}
+}
+
+// LibAvW_Demux_Stop
+// stops demux thread, queued packets are either dropped (before seeking) or kept to be decoded
+void LibAvW_Demux_Stop(avwstream_t *stream, bool flush)
+{
+	if (stream->demux_thread)
+	{
+		// without flush demuxer goes on from where thread stopped, so its read has to finish
+		stream->demux_abort = flush;
+		stream->demux_quit = true;
+		SetEvent(stream->demux_space);
+		WaitForSingleObject(stream->demux_thread, INFINITE);
+		stream->demux_abort = false;
+		// error of abandoned read, seek that follows clears end of file flag
+		if (flush && stream->AV_InputContext)
+			stream->AV_InputContext->error = 0;
+		CloseHandle(stream->demux_thread);
+		CloseHandle(stream->demux_data);
+		CloseHandle(stream->demux_space);
+		stream->demux_thread = NULL;
+		stream->demux_data = NULL;
+		stream->demux_space = NULL;
+	}
+	if (flush)
+	{
+		LibAvW_Queue_Flush(stream, &stream->videoqueue);
+		LibAvW_Queue_Flush(stream, &stream->audioqueue);
+	}
+}
+
+// LibAvW_Stream_InIoFiber
+// true if running on decoding fiber of the stream, only then it may be left for caller
+bool LibAvW_Stream_InIoFiber(avwstream_t *stream)
+{
+	return stream->io_inside && stream->io_fiber && GetCurrentFiber() == stream->io_fiber;
+}
+
+// LibAvW_Stream_ReadPacket
+// gets next video packet (or any packet when not pipelined),
+// returns 1 if there is a packet, 0 at end of stream, LIBAVW_PLAY_PENDING if out of time
+int LibAvW_Stream_ReadPacket(avwstream_t *stream, AVPacket *pkt)
+{
+	int64_t span;
+	bool got, eof;
+	int ret;
+
+	// packets left from pipelined mode go first
+	if (!stream->demux_thread)
+	{
+		if (LibAvW_Queue_Pop(stream, &stream->videoqueue, pkt, NULL))
+			return 1;
+		if (stream->videoqueue.eof)
+			return 0;
+		span = LibAvW_Span_Begin();
+		ret = av_read_frame(stream->AV_FormatContext, pkt);
+		LibAvW_Span_End("demux", stream, span);
+		if (ret < 0)
+			return 0;
+		LIBAVW_TRACE_ALLOC(pkt->size);
+		return 1;
+	}
+	for (;;)
+	{
+		EnterCriticalSection(&stream->demux_lock);
+		got = LibAvW_Queue_Pop(stream, &stream->videoqueue, pkt, NULL);
+		eof = stream->videoqueue.eof;
+		LeaveCriticalSection(&stream->demux_lock);
+		if (got)
+		{
+			SetEvent(stream->demux_space);
+			return 1;
+		}
+		if (eof)
+			return 0;
+
+		// starving, don't stall caller if it can take pending status
+		if (LibAvW_Stream_InIoFiber(stream))
+		{
+			if (stream->io_abort)
+				return 0;
+			SwitchToFiber(stream->io_caller);
+		}
+		else if (stream->decode_deadline)
+		{
+			if (LibAvW_Timer() >= stream->decode_deadline)
+				return LIBAVW_PLAY_PENDING;
+			WaitForSingleObject(stream->demux_data, 1);
+		}
+		else
+			WaitForSingleObject(stream->demux_data, INFINITE);
+	}
+}
+
+/*
+=================================================================
+
+ Video Stream
+
+=================================================================
+*/
+
+// LibAvW_CallerFiber
+// returns fiber of calling thread, thread is converted once and stays a fiber
+// (converting back and forth on every frame costs), NULL if it can't be converted
+LPVOID LibAvW_CallerFiber(void)
+{
+	LPVOID fiber;
+
+	fiber = ConvertThreadToFiber(NULL);
+	if (!fiber && GetLastError() == ERROR_ALREADY_FIBER)
+		fiber = GetCurrentFiber();
+	return fiber;
+}
+
+// LibAvW_Stream_UnwindPending
+// lets reads of pending non-blocking frame fail so its call frames free what they hold
+void LibAvW_Stream_UnwindPending(avwstream_t *stream)
+{
+	LPVOID caller;
+
+	if (!stream->io_inside)
+		return;
+	caller = LibAvW_CallerFiber();
+	if (!caller)
+		return; // fiber is leaked rather than deleted mid-frame
+	stream->io_caller = caller;
+	stream->io_abort = true;
+	while(stream->io_inside)
+		SwitchToFiber(stream->io_fiber);
+	stream->io_abort = false;
+}
+
+// LibAvW_Stream_CheckIdle
+// demuxer and decoder can't be used while a non-blocking frame is pending,
+// engine has to finish it with LibAvW_PlaySeekNextFrame or by turning non-blocking mode off
+bool LibAvW_Stream_CheckIdle(avwstream_t *stream)
+{
+	if (!stream->io_inside)
+		return true;
+	stream->lasterror = LIBAVW_ERROR_IO_PENDING;
+	return false;
+}
+
+// LibAvW_ResetStream
+void LibAvW_ResetStream(avwstream_t *stream)
+{
+	// pending read is unwound before demuxer goes away
+	LibAvW_Stream_UnwindPending(stream);
+	LibAvW_Reverse_Stop(stream);
+	LibAvW_Demux_Stop(stream, true);
+	if (stream->io_fiber && !stream->io_inside)
+		DeleteFiber(stream->io_fiber);
+	stream->io_fiber = NULL;
+	stream->io_inside = false;
+	stream->framerate = 0;
+	stream->numframes = 0;
+	stream->framewidth = 0;
+	stream->frameheight = 0;
+	stream->framenum = 0;
+	stream->frame_pts = 0;
+	stream->frame_duration = 0;
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	stream->AV_VideoStreamId = -1;
+	stream->AV_AudioStreamId = -1;
+	stream->AV_Codec = NULL;
+	// AV_InputFrame and AV_OutputFrame are kept until stream is removed
+	// AV_CodecContext
+	if (stream->AV_CodecContext)
+		avcodec_close(stream->AV_CodecContext);
+	stream->AV_CodecContext = NULL;
+	// AV_InputContext
+	if (stream->AV_InputContext)
+	{
+		av_free(stream->AV_InputContext->buffer);
+		av_free(stream->AV_InputContext);
+		LibAvW_Memory_Add(stream, &stream->memory.iobuffers, &libav_memory.iobuffers, -stream->memory.iobuffers);
+		stream->AV_InputContext = NULL;
+		if (stream->AV_FormatContext)
+			stream->AV_FormatContext->pb = NULL;
+	}
+	// AV_FormatContext
+	if (stream->AV_FormatContext)
+		av_close_input_file(stream->AV_FormatContext);
+	stream->AV_InputContext = NULL;
+	stream->AV_FormatContext = NULL;
+	// IO
+	stream->file = NULL;
+	stream->IO_Read = NULL;
+	stream->IO_Seek = NULL;
+	stream->IO_SeekSize = NULL;
+	// memory file
+	if (stream->memfile)
+		av_free(stream->memfile);
+	LibAvW_Memory_Add(stream, &stream->memory.memfiles, &libav_memory.memfiles, -stream->memory.memfiles);
+	stream->memfile = NULL;
+	stream->memfile_size = 0;
+	stream->memfile_pos = 0;
+	// frame cache
+	LibAvW_Disk_Close(stream);
+	stream->disk_finished = false;
+	LibAvW_Cache_Free(stream);
+	stream->cache_overflow = false;
+	// tiled output
+	if (stream->tile_image)
+		free(stream->tile_image);
+	LibAvW_Memory_Add(stream, &stream->memory.tiles, &libav_memory.tiles, -stream->tile_imagesize);
+	stream->tile_image = NULL;
+	stream->tile_imagesize = 0;
+}
+
+// LibAvW_Stream_OpenCodec
+// opens video decoder and starts reading ahead, streams playing from disk cache open it on first use
+int LibAvW_Stream_OpenCodec(avwstream_t *s)
+{
+	AVCodec *codec;
+
+	if (s->AV_Codec)
+		return 1;
+	if (!s->AV_CodecContext)
+	{
+		s->lasterror = LIBAVW_ERROR_OPEN_CODEC;
+		return 0;
+	}
+
+	// get decoder for video stream
+	codec = avcodec_find_decoder(s->AV_CodecContext->codec_id);
+	if (codec == NULL)
+	{
+		s->lasterror = LIBAVW_ERROR_FIND_CODEC;
+		return 0;
+	}
+
+	// open AV_Codec
+	// inform the AV_Codec that we can handle truncated bitstreams -- i.e.,
+	// bitstreams where AV_InputFrame boundaries can fall in the middle of packets
+	if (codec->capabilities & CODEC_CAP_TRUNCATED)
+		s->AV_CodecContext->flags |= CODEC_FLAG_TRUNCATED;
+	// decode at lower resolution when short on memory
+	if (s->lowres && codec->max_lowres > 0)
+		s->AV_CodecContext->lowres = 1;
+
+	// decode into pooled buffers
+	s->AV_CodecContext->opaque = s;
+	if (codec->capabilities & CODEC_CAP_DR1)
+	{
+		s->AV_CodecContext->get_buffer = LibAvW_GetBuffer;
+		s->AV_CodecContext->release_buffer = LibAvW_ReleaseBuffer;
+		s->AV_CodecContext->thread_safe_callbacks = 1;
+	}
+#ifdef LIBAV95
+	if (avcodec_open2(s->AV_CodecContext, codec, NULL) < 0)
+#else
+	if (avcodec_open(s->AV_CodecContext, codec) < 0)
+#endif
+	{
+		s->lasterror = LIBAVW_ERROR_OPEN_CODEC;
+		return 0;
+	}
+	s->AV_Codec = codec;
+	s->sequential = true; // demuxer was not moved yet
+	s->skipped_refs = false;
+	s->framewidth = s->AV_CodecContext->width;
+	s->frameheight = s->AV_CodecContext->height;
+
+	// read ahead in pipelined mode
+	LibAvW_Demux_Start(s);
+	return 1;
+}
+
+// LibAvW_Stream_Rewind
+// seeks decoder to the start of the stream
+int LibAvW_Stream_Rewind(avwstream_t *stream)
+{
+	int64_t start, span;
+
+	if (!stream->AV_FormatContext || !stream->AV_CodecContext)
+	{
+		stream->lasterror = LIBAVW_ERROR_SEEK;
+		return 0;
+	}
+	if (!LibAvW_Stream_OpenCodec(stream))
+		return 0;
+	start = stream->AV_FormatContext->streams[stream->AV_VideoStreamId]->start_time;
+	if (start == (int64_t)AV_NOPTS_VALUE)
+		start = 0;
+	LibAvW_Demux_Stop(stream, true);
+	span = LibAvW_Span_Begin();
+	if (av_seek_frame(stream->AV_FormatContext, stream->AV_VideoStreamId, start, AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		// some demuxers can only seek by byte position
+		if (av_seek_frame(stream->AV_FormatContext, -1, 0, AVSEEK_FLAG_BYTE) < 0)
+		{
+			LibAvW_Span_End("seek", stream, span);
+			LibAvW_Demux_Start(stream);
+			stream->lasterror = LIBAVW_ERROR_SEEK;
+			return 0;
+		}
+	}
+	LibAvW_Span_End("seek", stream, span);
+	LibAvW_Demux_Start(stream);
+	avcodec_flush_buffers(stream->AV_CodecContext);
+	stream->sequential = true;
+	stream->skipped_refs = false;
+	stream->framenum = 0;
+	stream->frame_pts = 0;
+	stream->frame_duration = 0;
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_Stream_SetFrameTime
+// gets presentation time and duration of just decoded frame
+void LibAvW_Stream_SetFrameTime(avwstream_t *stream)
+{
+	AVStream *st = stream->AV_FormatContext->streams[stream->AV_VideoStreamId];
+	int64_t ts, start;
+
+	ts = stream->AV_InputFrame->pkt_pts;
+	if (ts == (int64_t)AV_NOPTS_VALUE)
+		ts = stream->AV_InputFrame->pkt_dts;
+	start = (st->start_time == (int64_t)AV_NOPTS_VALUE) ? 0 : st->start_time;
+	if (ts != (int64_t)AV_NOPTS_VALUE)
+		stream->frame_pts = (double)(ts - start) * av_q2d(st->time_base);
+	else if (stream->framenum > 1)
+		stream->frame_pts += stream->frame_duration;
+	else
+		stream->frame_pts = 0;
+	stream->frame_duration = (1.0 + stream->AV_InputFrame->repeat_pict * 0.5) / stream->framerate;
+}
+
+// LibAvW_Stream_CurrentTime
+// time of presented frame
+double LibAvW_Stream_CurrentTime(avwstream_t *stream)
+{
+	if (stream->reverse && !stream->cache_playing)
+		return stream->rev_current ? stream->rev_current->pts : 0;
+	return stream->frame_pts;
+}
+
+// LibAvW_Stream_FrameReady
+// notifies engine that a new frame is ready
+void LibAvW_Stream_FrameReady(avwstream_t *stream)
+{
+	if (stream->frameready)
+		stream->frameready(stream, stream->frameready_data, LibAvW_Stream_CurrentTime(stream));
+	if (stream->frameready_event)
+		SetEvent(stream->frameready_event);
+}
+
+// LibAvW_Stream_DecodeFrame
+// decodes next video frame into AV_InputFrame
+int LibAvW_Stream_DecodeFrame(avwstream_t *stream)
+{
+	int frame_finished = 0, ret;
+	avwtracemark_t mark;
+	int64_t span;
+	AVPacket pkt;
+
+	LIBAVW_TRACE_BEGIN(mark);
+
+	// decoder of stream opened onto disk cache
+	if (!LibAvW_Stream_OpenCodec(stream))
+		return 0;
+
+	// read AV_InputFrame
+	av_init_packet(&pkt);
+	while((ret = LibAvW_Stream_ReadPacket(stream, &pkt)) > 0)
+	{
+		if (ret == LIBAVW_PLAY_PENDING)
+		{
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return LIBAVW_PLAY_PENDING;
+		}
+		// is this a packet from video stream
+		if (pkt.stream_index == stream->AV_VideoStreamId)
+		{
+			// decode into AV_InputFrame
+			span = LibAvW_Span_Begin();
+			ret = avcodec_decode_video2(stream->AV_CodecContext, stream->AV_InputFrame, &frame_finished, &pkt);
+			LibAvW_Span_End("decode", stream, span);
+			if (ret < 0)
+			{
+				stream->lasterror = LIBAVW_ERROR_DECODING_VIDEO_FRAME;
+				av_free_packet(&pkt);
+				return 0;
+			}
+			if (frame_finished)
+			{
+				// finished decoding a AV_InputFrame, when frames are skipped frame number follows pts
+				stream->framenum++;
+				LibAvW_Stream_SetFrameTime(stream);
+				if (stream->AV_CodecContext->skip_frame != AVDISCARD_DEFAULT)
+					stream->framenum = (int64_t)(stream->frame_pts * stream->framerate + 0.5) + 1;
+				stream->lasterror = LIBAVW_ERROR_NONE;
+				av_free_packet(&pkt);
+				LIBAVW_TRACE_FRAME(stream, mark);
+				return 1;
+			}
+		}
+		av_free_packet(&pkt);
+
+		// out of time, decoder keeps packets fed so far and next call goes on with next packet
+		if (stream->decode_deadline && LibAvW_Timer() >= stream->decode_deadline)
+		{
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return LIBAVW_PLAY_PENDING;
+		}
+	}
+	av_free_packet(&pkt);
+
+	// reached end of stream, frame cache now knows stream length (unless frames were skipped,
+	// pass did not start at first frame, e.g. on reverse prefetch thread, or pending read was unwound)
+	if (stream->framenum > 0 && stream->AV_CodecContext->skip_frame == AVDISCARD_DEFAULT && stream->sequential && !stream->io_abort)
+	{
+		stream->cache_numframes = (int)stream->framenum;
+		LibAvW_Disk_Finish(stream);
+	}
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 0;
+}
+
+// LibAvW_ScalerSize
+// estimated memory held by scale context (libav keeps it opaque), filter tables and line buffers
+int LibAvW_ScalerSize(int srcwidth, int srcheight, int dstwidth, int dstheight, int avscaler)
+{
+	int taps, htaps, vtaps;
+
+	if (avscaler & SWS_POINT)
+		taps = 1;
+	else if (avscaler & (SWS_FAST_BILINEAR | SWS_BILINEAR))
+		taps = 2;
+	else if (avscaler & SWS_BICUBIC)
+		taps = 4;
+	else
+		taps = 8;
+	// downscaling widens filters by scale factor
+	htaps = taps * FFMAX(1, srcwidth / FFMAX(dstwidth, 1));
+	vtaps = taps * FFMAX(1, srcheight / FFMAX(dstheight, 1));
+	// luma and chroma coefficients and positions, vertical filter line ring for 4 planes
+	return LIBAVW_SCALER_BASESIZE + 2 * (dstwidth * (htaps * 2 + 4) + dstheight * (vtaps * 2 + 4)) + 4 * 2 * vtaps * FFALIGN(dstwidth, 16) * 2;
+}
+
+// LibAvW_GetScaler
+// returns scale context for conversion, kept context is reused unless conversion changed
+SwsContext *LibAvW_GetScaler(avwstream_t *stream, avwscalecontext_t *scale, int srcwidth, int srcheight, PixelFormat srcformat, int dstwidth, int dstheight, PixelFormat dstformat, int avscaler)
+{
+	SwsContext *scale_context;
+	int bytes;
+
+	// old context is freed when another one is returned
+	scale_context = sws_getCachedContext(scale->context, srcwidth, srcheight, srcformat, dstwidth, dstheight, dstformat, avscaler, NULL, NULL, NULL);
+	if (scale_context != scale->context)
+	{
+		bytes = scale_context ? LibAvW_ScalerSize(srcwidth, srcheight, dstwidth, dstheight, avscaler) : 0;
+		if (scale_context)
+			LIBAVW_TRACE_ALLOC(bytes);
+		LibAvW_Memory_Add(stream, &stream->memory.scalers, &libav_memory.scalers, bytes - scale->bytes);
+		scale->bytes = bytes;
+	}
+	scale->context = scale_context;
+	return scale_context;
+}
+
+// LibAvW_FreeScaler
+void LibAvW_FreeScaler(avwstream_t *stream, avwscalecontext_t *scale)
+{
+	if (scale->context)
+		sws_freeContext(scale->context);
+	LibAvW_Memory_Add(stream, &stream->memory.scalers, &libav_memory.scalers, -scale->bytes);
+	scale->context = NULL;
+	scale->bytes = 0;
+}
+
+// LibAvW_Stream_FreeScalers
+// frees scale contexts kept by stream
+void LibAvW_Stream_FreeScalers(avwstream_t *stream)
+{
+	int i;
+
+	LibAvW_FreeScaler(stream, &stream->sws_image);
+	LibAvW_FreeScaler(stream, &stream->sws_matte);
+	LibAvW_FreeScaler(stream, &stream->sws_mip);
+	for (i = 0; i < 9; i++)
+		LibAvW_FreeScaler(stream, &stream->sws_tiles[i]);
+	for (i = 0; i < LIBAVW_MIP_CONTEXTS; i++)
+		LibAvW_FreeScaler(stream, &stream->sws_miplevels[i]);
+}
+
+// LibAvW_Stream_ConvertImage
+// converts picture into caller-supplied image buffer
+int LibAvW_Stream_ConvertImage(avwstream_t *stream, uint8_t **srcdata, int *srclinesize, int srcwidth, int srcheight, PixelFormat srcformat, PixelFormat avpixelformat, void *imagedata, int imagewidth, int imageheight, int avscaler)
+{
+	int64_t span;
+	int ret;
+
+	avpicture_fill((AVPicture *)stream->AV_OutputFrame, (uint8_t *)imagedata, avpixelformat, imagewidth, imageheight);
+	SwsContext *scale_context = LibAvW_GetScaler(stream, &stream->sws_image, srcwidth, srcheight, srcformat, imagewidth, imageheight, avpixelformat, avscaler);
+	if (!scale_context)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_SCALER;
+		return 0;
+	}
+	span = LibAvW_Span_Begin();
+	ret = sws_scale(scale_context, srcdata, srclinesize, 0, srcheight, stream->AV_OutputFrame->data, stream->AV_OutputFrame->linesize);
+	LibAvW_Span_End("convert", stream, span);
+	if (!ret)
+	{
+		stream->lasterror = LIBAVW_ERROR_APPLYING_SCALE;
+		return 0;
+	}
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_Alpha_Premultiply
+void LibAvW_Alpha_Premultiply(uint8_t *d, int a)
+{
+	d[0] = (uint8_t)((d[0] * a + 127) / 255);
+	d[1] = (uint8_t)((d[1] * a + 127) / 255);
+	d[2] = (uint8_t)((d[2] * a + 127) / 255);
+}
+
+// LibAvW_Alpha_ConvertYUV420
+// converts 4:2:0 planes and alpha (native plane or luma of a matte) into BGRA in one pass,
+// BT.601 coefficients as used by swscale
+void LibAvW_Alpha_ConvertYUV420(uint8_t **src, int *srclinesize, uint8_t *alpha, int alphalinesize, bool matte, bool fullrange, bool premultiply, uint8_t *dst, int dstlinesize, int width, int height)
+{
+	uint8_t *py, *pu, *pv, *pa, *d;
+	int x, y, c, u, v, a;
+
+	for (y = 0; y < height; y++)
+	{
+		py = src[0] + y * srclinesize[0];
+		pu = src[1] + (y >> 1) * srclinesize[1];
+		pv = src[2] + (y >> 1) * srclinesize[2];
+		pa = alpha + y * alphalinesize;
+		d = dst + y * dstlinesize;
+		for (x = 0; x < width; x++, d += 4)
+		{
+			u = pu[x >> 1] - 128;
+			v = pv[x >> 1] - 128;
+			if (fullrange)
+			{
+				c = py[x] << 8;
+				d[0] = av_clip_uint8((c + 454 * u + 128) >> 8);
+				d[1] = av_clip_uint8((c - 88 * u - 183 * v + 128) >> 8);
+				d[2] = av_clip_uint8((c + 359 * v + 128) >> 8);
+				a = pa[x];
+			}
+			else
+			{
+				c = (py[x] - 16) * 298;
+				d[0] = av_clip_uint8((c + 516 * u + 128) >> 8);
+				d[1] = av_clip_uint8((c - 100 * u - 208 * v + 128) >> 8);
+				d[2] = av_clip_uint8((c + 409 * v + 128) >> 8);
+				a = matte ? av_clip_uint8(((pa[x] - 16) * 298 + 128) >> 8) : pa[x];
+			}
+			d[3] = (uint8_t)a;
+			if (premultiply && a < 255)
+				LibAvW_Alpha_Premultiply(d, a);
+		}
+	}
+}
+
+// LibAvW_Stream_ConvertFrame
+// converts decoded frame into image applying stream alpha mode,
+// packed matte layouts only output the color region
+int LibAvW_Stream_ConvertFrame(avwstream_t *stream, uint8_t **srcdata, int *srclinesize, int srcwidth, int srcheight, PixelFormat srcformat, PixelFormat avpixelformat, void *imagedata, int imagewidth, int imageheight, int avscaler)
+{
+	const AVPixFmtDescriptor *desc;
+	uint8_t *colordata[4], *mattedata[4], *d, *m;
+	int mattelinesize[4], colorwidth, colorheight, layout, x, y, a;
+	bool premultiply, fullrange, matte;
+	avwpoolbuffer_t *buf;
+	SwsContext *scale_context;
+	int64_t span;
+
+	layout = stream->alphamode & ~LIBAVW_ALPHA_PREMULTIPLY;
+	premultiply = (stream->alphamode & LIBAVW_ALPHA_PREMULTIPLY) != 0;
+	if (layout == LIBAVW_ALPHA_NONE)
+		return LibAvW_Stream_ConvertImage(stream, srcdata, srclinesize, srcwidth, srcheight, srcformat, avpixelformat, imagedata, imagewidth, imageheight, avscaler);
+
+	// split color and alpha regions, matte must be a planar YUV frame
+	desc = av_pix_fmt_desc_get(srcformat);
+	matte = (layout == LIBAVW_ALPHA_SIDEBYSIDE || layout == LIBAVW_ALPHA_TOPBOTTOM);
+	if (matte && (!desc || !(desc->flags & PIX_FMT_PLANAR) || (desc->flags & PIX_FMT_RGB)))
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_ALPHA_MODE;
+		return 0;
+	}
+	colordata[0] = srcdata[0];
+	colordata[1] = srcdata[1];
+	colordata[2] = srcdata[2];
+	colordata[3] = srcdata[3];
+	colorwidth = srcwidth;
+	colorheight = srcheight;
+	mattedata[0] = srcdata[3];
+	mattelinesize[0] = srclinesize[3];
+	if (layout == LIBAVW_ALPHA_SIDEBYSIDE)
+	{
+		colorwidth = (srcwidth / 2) & ~((1 << desc->log2_chroma_w) - 1);
+		mattedata[0] = srcdata[0] + colorwidth;
+		mattelinesize[0] = srclinesize[0];
+	}
+	else if (layout == LIBAVW_ALPHA_TOPBOTTOM)
+	{
+		colorheight = (srcheight / 2) & ~((1 << desc->log2_chroma_h) - 1);
+		mattedata[0] = srcdata[0] + colorheight * srclinesize[0];
+		mattelinesize[0] = srclinesize[0];
+	}
+	else if (!desc || !(desc->flags & PIX_FMT_ALPHA))
+	{
+		// no alpha in this video
+		premultiply = false;
+		mattedata[0] = NULL;
+	}
+
+	// single pass at native size
+	fullrange = (srcformat == PIX_FMT_YUVJ420P);
+	if (avpixelformat == PIX_FMT_BGRA && mattedata[0] && imagewidth == colorwidth && imageheight == colorheight && (srcformat == PIX_FMT_YUV420P || srcformat == PIX_FMT_YUVJ420P || srcformat == PIX_FMT_YUVA420P))
+	{
+		span = LibAvW_Span_Begin();
+		LibAvW_Alpha_ConvertYUV420(colordata, srclinesize, mattedata[0], mattelinesize[0], matte, fullrange, premultiply, (uint8_t *)imagedata, imagewidth * 4, imagewidth, imageheight);
+		LibAvW_Span_End("convert", stream, span);
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		return 1;
+	}
+
+	// otherwise color is converted by swscale (along with native alpha)
+	if (!LibAvW_Stream_ConvertImage(stream, colordata, srclinesize, colorwidth, colorheight, srcformat, avpixelformat, imagedata, imagewidth, imageheight, avscaler))
+		return 0;
+	if (avpixelformat != PIX_FMT_BGRA || !mattedata[0])
+		return 1;
+	if (!matte)
+	{
+		if (premultiply)
+			for (y = 0, d = (uint8_t *)imagedata; y < imagewidth * imageheight; y++, d += 4)
+				LibAvW_Alpha_Premultiply(d, d[3]);
+		return 1;
+	}
+
+	// and matte luma is scaled into alpha channel
+	buf = LibAvW_Pool_Alloc(imagewidth * imageheight);
+	if (!buf)
+	{
+		stream->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+		return 0;
+	}
+	scale_context = LibAvW_GetScaler(stream, &stream->sws_matte, colorwidth, colorheight, PIX_FMT_GRAY8, imagewidth, imageheight, PIX_FMT_GRAY8, avscaler);
+	if (!scale_context)
+	{
+		LibAvW_Pool_Free(buf);
+		stream->lasterror = LIBAVW_ERROR_BAD_SCALER;
+		return 0;
+	}
+	mattedata[1] = mattedata[2] = mattedata[3] = NULL;
+	mattelinesize[1] = mattelinesize[2] = mattelinesize[3] = 0;
+	m = buf->data;
+	if (!sws_scale(scale_context, mattedata, mattelinesize, 0, colorheight, &m, &imagewidth))
+	{
+		LibAvW_Pool_Free(buf);
+		stream->lasterror = LIBAVW_ERROR_APPLYING_SCALE;
+		return 0;
+	}
+	d = (uint8_t *)imagedata;
+	for (y = 0; y < imageheight; y++)
+	{
+		for (x = 0; x < imagewidth; x++, d += 4, m++)
+		{
+			a = fullrange ? *m : av_clip_uint8(((*m - 16) * 298 + 128) >> 8);
+			d[3] = (uint8_t)a;
+			if (premultiply && a < 255)
+				LibAvW_Alpha_Premultiply(d, a);
+		}
+	}
+	LibAvW_Pool_Free(buf);
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_StreamGetVideoWidth
+DLL_EXPORT int LibAvW_StreamGetVideoWidth(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	// packed matte is not part of the picture
+	s->lasterror = LIBAVW_ERROR_NONE;
+	if ((s->alphamode & ~LIBAVW_ALPHA_PREMULTIPLY) == LIBAVW_ALPHA_SIDEBYSIDE)
+		return s->framewidth / 2;
+	return s->framewidth;
+}
+
+// LibAvW_StreamGetVideoHeight
+DLL_EXPORT int LibAvW_StreamGetVideoHeight(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	// packed matte is not part of the picture
+	s->lasterror = LIBAVW_ERROR_NONE;
+	if ((s->alphamode & ~LIBAVW_ALPHA_PREMULTIPLY) == LIBAVW_ALPHA_TOPBOTTOM)
+		return s->frameheight / 2;
+	return s->frameheight;
+}
+
+// LibAvW_StreamGetFramerate
+DLL_EXPORT double LibAvW_StreamGetFramerate(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return s->framerate;
+}
+
+// LibAvW_StreamGetFrameTime
+DLL_EXPORT int LibAvW_StreamGetFrameTime(void *stream, double *pts, double *duration, double *nextpts, double *nextduration)
+{
+	avwstream_t *s;
+	double frameduration;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	s->lasterror = LIBAVW_ERROR_NONE;
+	frameduration = (s->framerate > 0) ? 1.0 / s->framerate : 0;
+
+	// in reverse next frame is expected right before current one
+	if (s->reverse && !s->cache_playing)
+	{
+		if (!s->rev_current)
+			return 0;
+		if (pts)
+			*pts = s->rev_current->pts;
+		if (duration)
+			*duration = s->rev_current->duration;
+		if (nextpts)
+			*nextpts = FFMAX(0, s->rev_current->pts - frameduration);
+		if (nextduration)
+			*nextduration = frameduration;
+		return 1;
+	}
+
+	// next frame is expected right after current one
+	if (pts)
+		*pts = s->frame_pts;
+	if (duration)
+		*duration = s->frame_duration;
+	if (nextpts)
+		*nextpts = (s->framenum > 0) ? s->frame_pts + s->frame_duration : 0;
+	if (nextduration)
+		*nextduration = frameduration;
+	return (s->framenum > 0) ? 1 : 0;
+}
+
+// LibAvW_StreamSetFrameCallback
+DLL_EXPORT int LibAvW_StreamSetFrameCallback(void *stream, avwCallbackFrameReady *callback, void *userdata)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	s->frameready = callback;
+	s->frameready_data = userdata;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_StreamGetFrameEvent
+DLL_EXPORT void *LibAvW_StreamGetFrameEvent(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return NULL;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return NULL;
+
+	if (!s->frameready_event)
+		s->frameready_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return s->frameready_event;
+}
+
+// LibAvW_StreamGetError
+DLL_EXPORT int LibAvW_StreamGetError(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return -1;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return -1;
+
+	return s->lasterror;
+}
+
+// LibAvW_Stream_DropCache
+// frees frame cache, decoder is brought back to current frame if it was bypassed
+int LibAvW_Stream_DropCache(avwstream_t *stream)
+{
+	int64_t framenum;
+
+	if (!stream->cache_playing)
+	{
+		LibAvW_Disk_Close(stream);
+		LibAvW_Cache_Free(stream);
+		return 1;
+	}
+	framenum = stream->framenum;
+	LibAvW_Disk_Close(stream);
+	LibAvW_Cache_Free(stream);
+	if (!LibAvW_Stream_Rewind(stream))
+		return 0;
+	while(stream->framenum < framenum)
+		if (!LibAvW_Stream_DecodeFrame(stream))
+			break;
+	return 1;
+}
+
+// LibAvW_Stream_SeekKeyframe
+// positions demuxer at keyframe at or before time and flushes decoder, nothing is decoded
+int LibAvW_Stream_SeekKeyframe(avwstream_t *stream, double time)
+{
+	AVStream *st;
+	int64_t ts, span;
+	int ret;
+
+	if (!stream->AV_FormatContext || !stream->AV_CodecContext)
+	{
+		stream->lasterror = LIBAVW_ERROR_SEEK;
+		return 0;
+	}
+	if (!LibAvW_Stream_OpenCodec(stream))
+		return 0;
+	st = stream->AV_FormatContext->streams[stream->AV_VideoStreamId];
+	ts = (int64_t)(time / av_q2d(st->time_base));
+	if (st->start_time != (int64_t)AV_NOPTS_VALUE)
+		ts += st->start_time;
+	LibAvW_Demux_Stop(stream, true);
+	span = LibAvW_Span_Begin();
+	ret = av_seek_frame(stream->AV_FormatContext, stream->AV_VideoStreamId, ts, AVSEEK_FLAG_BACKWARD);
+	LibAvW_Span_End("seek", stream, span);
+	if (ret < 0)
+	{
+		LibAvW_Demux_Start(stream);
+		stream->lasterror = LIBAVW_ERROR_SEEK;
+		return 0;
+	}
+	LibAvW_Demux_Start(stream);
+	avcodec_flush_buffers(stream->AV_CodecContext);
+	stream->sequential = false; // frames are counted from keyframe
+	stream->skipped_refs = false;
+	stream->framenum = 0;
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_Stream_SeekTime
+// seeks to keyframe at or before time and decodes up to the frame that covers time,
+// in keyframe decode mode stops at that keyframe
+int LibAvW_Stream_SeekTime(avwstream_t *stream, double time)
+{
+	if (time < 0)
+		time = 0;
+
+	// whole clip is in memory
+	if (stream->cache_playing)
+	{
+		stream->framenum = FFMIN((int64_t)(time * stream->framerate) + 1, stream->cache_numframes);
+		stream->frame_duration = 1.0 / stream->framerate;
+		stream->frame_pts = (double)(stream->framenum - 1) * stream->frame_duration;
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		return 1;
+	}
+
+	if (!LibAvW_Stream_SeekKeyframe(stream, time))
+		return 0;
+	for (;;)
+	{
+		if (!LibAvW_Stream_DecodeFrame(stream))
+			return 0;
+		stream->framenum = (int64_t)(stream->frame_pts * stream->framerate + 0.5) + 1;
+		if (stream->decodemode == LIBAVW_DECODE_KEYFRAMES || stream->frame_pts + stream->frame_duration > time)
+			return 1;
+	}
+}
+
+// LibAvW_Stream_PrevFrame
+// steps back one frame (one keyframe in keyframe decode mode)
+int LibAvW_Stream_PrevFrame(avwstream_t *stream)
+{
+	double time;
+
+	if (stream->framenum <= 1 || stream->frame_pts <= 0)
+	{
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		return 0;
+	}
+	if (stream->cache_playing || stream->decodemode != LIBAVW_DECODE_KEYFRAMES)
+		time = stream->frame_pts - stream->frame_duration * 0.5;
+	else
+		time = stream->frame_pts - 0.001;
+	return LibAvW_Stream_SeekTime(stream, time);
+}
+
+// LibAvW_Reverse_FillGOP
+// seeks to keyframe before boundary and keeps every frame decoded from it up to boundary,
+// only last frames are kept if GOP is longer than buffer
+void LibAvW_Reverse_FillGOP(avwstream_t *stream, avwrevgop_t *gop, double boundary)
+{
+	avwrevframe_t *f;
+	AVFrame *in;
+	double last, back;
+	int size, maxframes;
+
+	LibAvW_Reverse_FreeGOP(stream, gop);
+	gop->startpts = 0;
+	last = boundary - 0.5 / stream->framerate;
+	if (last < 0)
+		return;
+
+	// index may point past frames wanted here, back off further until something is decoded
+	for (back = 0; gop->numframes == 0; back = back * 2 + 1.0)
+	{
+		if (!LibAvW_Stream_SeekKeyframe(stream, FFMAX(last - back, 0)))
+			return;
+		while(LibAvW_Stream_DecodeFrame(stream) == LIBAVW_PLAY_FRAME && stream->frame_pts < last)
+		{
+			in = stream->AV_InputFrame;
+			size = avpicture_get_size((PixelFormat)in->format, in->width, in->height);
+			maxframes = FFMAX(1, FFMIN(LIBAVW_REVERSE_MAXFRAMES, LIBAVW_REVERSE_MAXBYTES / FFMAX(size, 1)));
+			if (gop->numframes >= maxframes)
+			{
+				// drop oldest
+				LibAvW_Pool_Release(stream, gop->frames[0].buf);
+				memmove(gop->frames, gop->frames + 1, sizeof(avwrevframe_t) * (gop->numframes - 1));
+				gop->numframes--;
+			}
+			f = &gop->frames[gop->numframes];
+			f->buf = LibAvW_Pool_Alloc(size);
+			if (!f->buf)
+				break;
+			LibAvW_Memory_Add(stream, &stream->memory.frames, &libav_memory.frames, f->buf->size);
+			f->format = (PixelFormat)in->format;
+			f->width = in->width;
+			f->height = in->height;
+			f->pts = stream->frame_pts;
+			f->duration = stream->frame_duration;
+			avpicture_fill(&f->picture, f->buf->data, f->format, f->width, f->height);
+			av_picture_copy(&f->picture, (AVPicture *)in, f->format, f->width, f->height);
+			gop->numframes++;
+		}
+		if (last - back <= 0 || back >= 8.0)
+			break;
+	}
+	if (gop->numframes > 0)
+		gop->startpts = gop->frames[0].pts;
+}
+
+// LibAvW_ReverseThread
+// fills back GOP while frames of front GOP are handed out
+unsigned int __stdcall LibAvW_ReverseThread(void *arg)
+{
+	avwstream_t *stream = (avwstream_t *)arg;
+
+	for (;;)
+	{
+		WaitForSingleObject(stream->rev_wake, INFINITE);
+		if (stream->rev_quit)
+			break;
+		LibAvW_Reverse_FillGOP(stream, stream->rev_back, stream->rev_boundary);
+		SetEvent(stream->rev_filled);
+	}
+	return 0;
+}
+
+// LibAvW_Reverse_Prefetch
+// starts filling back GOP with frames before boundary
+void LibAvW_Reverse_Prefetch(avwstream_t *stream, double boundary)
+{
+	stream->rev_boundary = boundary;
+	stream->rev_pending = true;
+	if (stream->rev_thread)
+		SetEvent(stream->rev_wake);
+	else
+		LibAvW_Reverse_FillGOP(stream, stream->rev_back, boundary);
+}
+
+// LibAvW_Reverse_Start
+// starts reverse playback from current frame (or from the end if nothing was decoded yet)
+int LibAvW_Reverse_Start(avwstream_t *stream)
+{
+	double boundary;
+
+	if (!stream->AV_FormatContext || !stream->AV_CodecContext)
+	{
+		stream->lasterror = LIBAVW_ERROR_SEEK;
+		return 0;
+	}
+	if (stream->framenum > 0)
+		boundary = stream->frame_pts + stream->frame_duration * 0.5;
+	else if (stream->AV_FormatContext->duration != (int64_t)AV_NOPTS_VALUE)
+		boundary = (double)stream->AV_FormatContext->duration / AV_TIME_BASE + 1.0;
+	else
+	{
+		stream->lasterror = LIBAVW_ERROR_SEEK;
+		return 0;
+	}
+	stream->rev_front = (avwrevgop_t *)malloc(sizeof(avwrevgop_t));
+	stream->rev_back = (avwrevgop_t *)malloc(sizeof(avwrevgop_t));
+	if (!stream->rev_front || !stream->rev_back)
+	{
+		LibAvW_Reverse_Stop(stream);
+		stream->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
+		return 0;
+	}
+	LIBAVW_TRACE_ALLOC(sizeof(avwrevgop_t) * 2);
+	stream->rev_front->numframes = 0;
+	stream->rev_front->startpts = boundary;
+	stream->rev_back->numframes = 0;
+	stream->rev_back->startpts = boundary;
+	stream->rev_current = NULL;
+	stream->rev_pos = -1;
+	stream->reverse = true;
+
+	// decoder belongs to prefetch thread from now on
+	stream->rev_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	stream->rev_filled = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (stream->rev_wake && stream->rev_filled)
+		stream->rev_thread = (HANDLE)_beginthreadex(NULL, 0, LibAvW_ReverseThread, stream, 0, NULL);
+	if (!stream->rev_thread)
+	{
+		if (stream->rev_wake)
+			CloseHandle(stream->rev_wake);
+		if (stream->rev_filled)
+			CloseHandle(stream->rev_filled);
+		stream->rev_wake = NULL;
+		stream->rev_filled = NULL;
+	}
+	LibAvW_Reverse_Prefetch(stream, boundary);
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_Reverse_NextFrame
+// hands out previous frame
+int LibAvW_Reverse_NextFrame(avwstream_t *stream)
+{
+	avwrevgop_t *gop;
+
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	if (stream->rev_pos < 0)
+	{
+		// front GOP is exhausted, swap in prefetched one
+		if (!stream->rev_pending)
+			return 0;
+		if (stream->rev_thread)
+			WaitForSingleObject(stream->rev_filled, INFINITE);
+		stream->rev_pending = false;
+		stream->rev_current = NULL;
+		gop = stream->rev_front;
+		stream->rev_front = stream->rev_back;
+		stream->rev_back = gop;
+		stream->rev_pos = stream->rev_front->numframes - 1;
+		if (stream->rev_pos < 0)
+			return 0;
+		if (stream->rev_front->startpts > 0)
+			LibAvW_Reverse_Prefetch(stream, stream->rev_front->startpts);
+	}
+	// frame_pts and framenum belong to prefetch thread, presented frame is rev_current
+	stream->rev_current = &stream->rev_front->frames[stream->rev_pos--];
+	return 1;
+}
+
+// LibAvW_Reverse_SeekTime
+// restarts reverse playback from frame that covers time
+int LibAvW_Reverse_SeekTime(avwstream_t *stream, double time)
+{
+	LibAvW_Reverse_Stop(stream);
+	if (!LibAvW_Stream_SeekTime(stream, time) || !LibAvW_Reverse_Start(stream))
+		return 0;
+	return LibAvW_Reverse_NextFrame(stream);
+}
+
+// LibAvW_Stream_SetReverse
+int LibAvW_Stream_SetReverse(avwstream_t *stream, bool reverse)
+{
+	double pts;
+
+	if (reverse == stream->reverse)
+		return 1;
+
+	// fully cached clip is simply stepped backwards
+	if (stream->cache_playing)
+	{
+		stream->reverse = reverse;
+		return 1;
+	}
+	if (reverse)
+		return LibAvW_Reverse_Start(stream);
+
+	// bring decoder back to presented frame
+	if (!stream->rev_current)
+	{
+		LibAvW_Reverse_Stop(stream);
+		return LibAvW_Stream_Rewind(stream);
+	}
+	pts = stream->rev_current->pts;
+	LibAvW_Reverse_Stop(stream);
+	return LibAvW_Stream_SeekTime(stream, pts);
+}
+
+// LibAvW_Stream_NextFrame
+// advances stream by one frame
+int LibAvW_Stream_NextFrame(avwstream_t *stream)
+{
+	double time;
+
+	// over memory limit, caches go first
+	if (stream->cache_size > 0 && !LibAvW_Memory_Fits(0))
+	{
+		stream->cache_overflow = true;
+		if (!LibAvW_Stream_DropCache(stream))
+			return 0;
+		if (stream->reverse && !stream->rev_front)
+		{
+			stream->reverse = false;
+			if (!LibAvW_Reverse_Start(stream))
+				return 0;
+		}
+	}
+
+	// looping from frame cache
+	if (stream->cache_playing)
+	{
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		if (stream->reverse)
+		{
+			if (stream->framenum <= 1)
+				return 0;
+			stream->framenum--;
+		}
+		else if (stream->framenum >= stream->cache_numframes)
+			return 0;
+		else
+			stream->framenum++;
+		stream->frame_duration = 1.0 / stream->framerate;
+		stream->frame_pts = (double)(stream->framenum - 1) * stream->frame_duration;
+		return 1;
+	}
+	if (stream->reverse)
+		return LibAvW_Reverse_NextFrame(stream);
+
+	// frames were skipped at keyframe-only speed, decoding goes on from keyframe
+	// covering next frame, or advanced clock if it still belongs to presented frame and is further
+	if (stream->skipped_refs && stream->AV_CodecContext && stream->AV_CodecContext->skip_frame != AVDISCARD_NONKEY)
+	{
+		stream->skipped_refs = false;
+		time = stream->frame_pts + stream->frame_duration;
+		if (LibAvW_Stream_CurrentTime(stream) == stream->clock_pts)
+			time = FFMAX(time, stream->clock);
+		return LibAvW_Stream_SeekTime(stream, time);
+	}
+	return LibAvW_Stream_DecodeFrame(stream);
+}
+
+// LibAvW_IoFiber
+// decodes frames on behalf of LibAvW_Stream_StepFrame
+void CALLBACK LibAvW_IoFiber(void *arg)
+{
+	avwstream_t *stream = (avwstream_t *)arg;
+
+	for (;;)
+	{
+		stream->io_inside = true;
+		stream->io_result = LibAvW_Stream_NextFrame(stream);
+		stream->io_inside = false;
+		stream->io_done = true;
+		SwitchToFiber(stream->io_caller);
+	}
+}
+
+// LibAvW_Stream_StepFrame
+// advances stream by one frame, with non-blocking I/O returns LIBAVW_PLAY_PENDING
+// if data is not there yet, next call resumes where reading stopped
+int LibAvW_Stream_StepFrame(avwstream_t *stream)
+{
+	LPVOID caller;
+
+	if (!stream->nonblocking)
+		return LibAvW_Stream_NextFrame(stream);
+	if (!stream->io_fiber)
+	{
+		stream->io_fiber = CreateFiber(0, LibAvW_IoFiber, stream);
+		if (!stream->io_fiber)
+			return LibAvW_Stream_NextFrame(stream);
+	}
+
+	caller = LibAvW_CallerFiber();
+	if (!caller)
+	{
+		if (!stream->io_inside)
+			return LibAvW_Stream_NextFrame(stream);
+		stream->lasterror = LIBAVW_ERROR_IO_PENDING;
+		return 0;
+	}
+	stream->io_caller = caller;
+	stream->io_done = false;
+	SwitchToFiber(stream->io_fiber);
+	if (!stream->io_done)
+	{
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		return LIBAVW_PLAY_PENDING;
+	}
+	return stream->io_result;
+}
+
+// LibAvW_PlaySeekNextFrame
+DLL_EXPORT int LibAvW_PlaySeekNextFrame(void *stream)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	LIBAVW_TRACE_BEGIN(mark);
+	ret = LibAvW_Stream_StepFrame(s);
+	if (ret == LIBAVW_PLAY_FRAME)
+		LibAvW_Stream_FrameReady(s);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// LibAvW_Stream_RateDiscard
+// frames skipped before decode at current playback speed
+AVDiscard LibAvW_Stream_RateDiscard(avwstream_t *stream)
+{
+	if (stream->decodemode == LIBAVW_DECODE_KEYFRAMES || stream->rate >= LIBAVW_RATE_KEYFRAMES)
+		return AVDISCARD_NONKEY;
+	if (stream->rate >= LIBAVW_RATE_NONREF)
+		return AVDISCARD_NONREF;
+	return AVDISCARD_DEFAULT;
+}
+
+// LibAvW_Stream_Advance
+// moves stream clock by elapsed time scaled by playback rate and steps to the frame that covers it,
+// returns 1 if a new frame is presented, 2 if current frame is still valid, 0 at end of stream
+int LibAvW_Stream_Advance(avwstream_t *stream, double elapsed)
+{
+	AVDiscard discard;
+	double pts;
+	int frames, ret;
+	bool stepped;
+
+	// stream was seeked outside, clock follows it
+	pts = LibAvW_Stream_CurrentTime(stream);
+	if (pts != stream->clock_pts)
+		stream->clock = pts;
+	if (stream->reverse)
+		stream->clock -= elapsed * stream->rate;
+	else
+		stream->clock += elapsed * stream->rate;
+
+	// drop frames before decode at high speeds, reverse playback decodes whole GOPs anyway
+	discard = LibAvW_Stream_RateDiscard(stream);
+	if (stream->AV_CodecContext && !stream->reverse)
+		stream->AV_CodecContext->skip_frame = discard;
+	ret = 1;
+	stepped = false;
+	for (frames = 0;; frames++)
+	{
+		if (stream->reverse)
+		{
+			if ((stream->cache_playing ? stream->framenum > 0 : stream->rev_current != NULL) && LibAvW_Stream_CurrentTime(stream) <= stream->clock)
+				break;
+		}
+		else if (stream->framenum > 0 && stream->frame_pts + stream->frame_duration > stream->clock)
+			break;
+		stepped = true;
+		ret = LibAvW_Stream_StepFrame(stream);
+		if (ret != LIBAVW_PLAY_FRAME)
+		{
+			ret = (ret == LIBAVW_PLAY_PENDING) ? 1 : 0;
+			break;
+		}
+	}
+	if (stepped && discard == AVDISCARD_NONKEY && stream->decodemode != LIBAVW_DECODE_KEYFRAMES && !stream->reverse && !stream->cache_playing)
+		stream->skipped_refs = true;
+	if (stream->AV_CodecContext && !stream->reverse)
+		stream->AV_CodecContext->skip_frame = (stream->decodemode == LIBAVW_DECODE_KEYFRAMES) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+	stream->clock_pts = LibAvW_Stream_CurrentTime(stream);
+	if (frames > 0)
+	{
+		LibAvW_Stream_FrameReady(stream);
+		return 1;
+	}
+	return ret ? 2 : 0;
+}
+
+// LibAvW_PlayAdvance
+DLL_EXPORT int LibAvW_PlayAdvance(void *stream, double elapsed)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	LIBAVW_TRACE_BEGIN(mark);
+	s->lasterror = LIBAVW_ERROR_NONE;
+	ret = LibAvW_Stream_Advance(s, elapsed);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// LibAvW_PlaySeekNextFrameBudget
+DLL_EXPORT int LibAvW_PlaySeekNextFrameBudget(void *stream, int budget)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	LIBAVW_TRACE_BEGIN(mark);
+	// prefetch thread of reverse playback decodes whole GOPs regardless of budget
+	if (!s->reverse)
+		s->decode_deadline = LibAvW_Timer() + FFMAX(budget, 1) * libav_timer_frequency / 1000000;
+	ret = LibAvW_Stream_StepFrame(s);
+	s->decode_deadline = 0;
+	if (ret == LIBAVW_PLAY_FRAME)
+		LibAvW_Stream_FrameReady(s);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// LibAvW_PlaySeekTime
+DLL_EXPORT int LibAvW_PlaySeekTime(void *stream, double time)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	// reverse playback is restarted from new position
+	if (s->reverse && !s->cache_playing)
+	{
+		if (!LibAvW_Reverse_SeekTime(s, time))
+			return 0;
+	}
+	else if (!LibAvW_Stream_SeekTime(s, time))
+		return 0;
+	LibAvW_Stream_FrameReady(s);
+	return 1;
+}
+
+// LibAvW_PlaySeekPrevFrame
+DLL_EXPORT int LibAvW_PlaySeekPrevFrame(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	// stepping against reverse playback goes one frame forward
+	if (s->reverse && !s->cache_playing)
+	{
+		if (!s->rev_current || !LibAvW_Reverse_SeekTime(s, s->rev_current->pts + s->rev_current->duration * 1.5))
+			return 0;
+	}
+	else if (!LibAvW_Stream_PrevFrame(s))
+		return 0;
+	LibAvW_Stream_FrameReady(s);
+	return 1;
+}
+
+// LibAvW_PlayRewind
+DLL_EXPORT int LibAvW_PlayRewind(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	// whole clip is cached, decoder is no longer needed
+	EnterCriticalSection(&s->cache_lock);
+	if (LibAvW_Disk_Map(s) || LibAvW_Cache_Complete(s))
+	{
+		s->cache_playing = true;
+		s->framenum = 0;
+		s->lasterror = LIBAVW_ERROR_NONE;
+		LeaveCriticalSection(&s->cache_lock);
+		return 1;
+	}
+	LeaveCriticalSection(&s->cache_lock);
+	return LibAvW_Stream_Rewind(s);
+}
+
+// LibAvW_Stream_AutoScaler
+// resolves LIBAVW_SCALER_AUTO to scaler of current quality step
+int LibAvW_Stream_AutoScaler(avwstream_t *stream, int scaler)
+{
+	if (scaler != LIBAVW_SCALER_AUTO)
+		return scaler;
+	if (!stream)
+		return LIBAVW_SCALER_BILINEAR;
+	return libav_autoscalers[stream->auto_level];
+}
+
+// LibAvW_Stream_AutoMeasure
+// accounts conversion started at given time, steps scaler quality down while over budget
+// and back up after a long run well under budget, backing off if that does not hold
+void LibAvW_Stream_AutoMeasure(avwstream_t *stream, int64_t start)
+{
+	double cost, budget;
+
+	cost = (double)(LibAvW_Timer() - start) * 1000000.0 / libav_timer_frequency;
+	budget = (stream->scaler_budget > 0) ? stream->scaler_budget : libav_scaler_budget;
+	stream->auto_cost = stream->auto_samples ? (stream->auto_cost * 0.875 + cost * 0.125) : cost;
+	stream->auto_samples++;
+
+	// too slow
+	if (stream->auto_cost > budget)
+	{
+		stream->auto_under = 0;
+		if (stream->auto_samples >= LIBAVW_AUTOSCALER_DOWNWAIT && stream->auto_level < LIBAVW_AUTOSCALER_LEVELS - 1)
+		{
+			if (stream->auto_raised)
+				stream->auto_upwait = FFMIN(stream->auto_upwait * 2, LIBAVW_AUTOSCALER_MAXUPWAIT);
+			stream->auto_level++;
+			stream->auto_samples = 0;
+			stream->auto_raised = false;
+		}
+		return;
+	}
+
+	// better step held, relax backoff
+	if (stream->auto_raised && stream->auto_samples >= stream->auto_upwait)
+	{
+		stream->auto_upwait = FFMAX(stream->auto_upwait / 2, LIBAVW_AUTOSCALER_UPWAIT);
+		stream->auto_raised = false;
+	}
+
+	// clearly fast enough
+	if (stream->auto_cost >= budget * 0.5)
+	{
+		stream->auto_under = 0;
+		return;
+	}
+	stream->auto_under++;
+	if (stream->auto_under >= stream->auto_upwait && stream->auto_level > 0)
+	{
+		stream->auto_level--;
+		stream->auto_samples = 0;
+		stream->auto_under = 0;
+		stream->auto_raised = true;
+	}
+}
+
+// LibAvW_Stream_GetFrameImage
+// converts current frame into caller-supplied image
+int LibAvW_Stream_GetFrameImage(avwstream_t *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
+{
+	PixelFormat avpixelformat;
+	int avscaler, imagesize, ret;
+	unsigned char *cached;
+	AVPicture cachedpicture;
+	int64_t start;
+	bool autoscale;
+
+	// get pixel format
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+
+	// get scaler
+	autoscale = (scaler == LIBAVW_SCALER_AUTO);
+	scaler = LibAvW_Stream_AutoScaler(stream, scaler);
+	if (scaler >= LIBAVW_SCALER_BILINEAR && scaler <= LIBAVW_SCALER_SPLINE)
+		avscaler = libav_scalers[scaler];
+	else
+	{
+		stream->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
+		return 0;
+	}
+	start = autoscale ? LibAvW_Timer() : 0;
+
+	// reverse playback hands out buffered frames
+	if (stream->reverse && !stream->cache_playing)
+	{
+		if (!stream->rev_current)
+		{
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return 0;
+		}
+		ret = LibAvW_Stream_ConvertFrame(stream, stream->rev_current->picture.data, stream->rev_current->picture.linesize, stream->rev_current->width, stream->rev_current->height, stream->rev_current->format, avpixelformat, imagedata, imagewidth, imageheight, avscaler);
+		if (ret && autoscale)
+			LibAvW_Stream_AutoMeasure(stream, start);
+		return ret;
+	}
+
+	// get cached image
+	imagesize = avpicture_get_size(avpixelformat, imagewidth, imageheight);
+	cached = LibAvW_Cache_GetFrame(stream);
+	if (cached)
+	{
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		// automatic scaler takes cached image of any quality step
+		if (stream->cache_pixelformat == pixel_format && stream->cache_width == imagewidth && stream->cache_height == imageheight && (stream->cache_scaler == scaler || autoscale))
+		{
+			memcpy(imagedata, cached, imagesize);
+			return 1;
+		}
+		// settings differ from cached ones, convert from cached image
+		avpicture_fill(&cachedpicture, cached, LibAvW_GetPixelFormat(stream->cache_pixelformat), stream->cache_width, stream->cache_height);
+		ret = LibAvW_Stream_ConvertImage(stream, cachedpicture.data, cachedpicture.linesize, stream->cache_width, stream->cache_height, LibAvW_GetPixelFormat(stream->cache_pixelformat), avpixelformat, imagedata, imagewidth, imageheight, avscaler);
+		if (ret && autoscale)
+			LibAvW_Stream_AutoMeasure(stream, start);
+		return ret;
+	}
+
+	// get AV_InputFrame
+	if (!LibAvW_Stream_ConvertFrame(stream, stream->AV_InputFrame->data, stream->AV_InputFrame->linesize, stream->AV_InputFrame->width, stream->AV_InputFrame->height, (PixelFormat)stream->AV_InputFrame->format, avpixelformat, imagedata, imagewidth, imageheight, avscaler))
+		return 0;
+	if (autoscale)
+		LibAvW_Stream_AutoMeasure(stream, start);
+
+	// allright
+	LibAvW_Cache_StoreFrame(stream, pixel_format, imagedata, imagewidth, imageheight, scaler, autoscale, imagesize);
+	LibAvW_Disk_StoreFrame(stream, pixel_format, imagedata, imagewidth, imageheight, scaler, imagesize);
+	return 1;
+}
+
+// LibAvW_PlayGetFrameImage
+// writes frame at video size, image size only gives row pitch and bounds
+DLL_EXPORT int LibAvW_PlayGetFrameImage(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	avwpoolbuffer_t *buf;
+	PixelFormat avpixelformat;
+	int ret, width, height, bpp, row;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+	bpp = (avpixelformat == PIX_FMT_BGRA) ? 4 : 3;
+	width = LibAvW_StreamGetVideoWidth(s);
+	height = LibAvW_StreamGetVideoHeight(s);
+
+	LIBAVW_TRACE_BEGIN(mark);
+	EnterCriticalSection(&s->cache_lock);
+	if (imagewidth == width && imageheight >= height)
+		ret = LibAvW_Stream_GetFrameImage(s, pixel_format, imagedata, width, height, scaler);
+	else
+	{
+		// other pitch, frame is converted aside and copied row by row
+		ret = 0;
+		buf = LibAvW_Pool_Alloc(avpicture_get_size(avpixelformat, width, height));
+		if (!buf)
+			s->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
+		else
+		{
+			ret = LibAvW_Stream_GetFrameImage(s, pixel_format, buf->data, width, height, scaler);
+			if (ret)
+				for (row = 0; row < FFMIN(height, imageheight); row++)
+					memcpy((uint8_t *)imagedata + row * imagewidth * bpp, buf->data + row * width * bpp, FFMIN(width, imagewidth) * bpp);
+			LibAvW_Pool_Free(buf);
+		}
+	}
+	LeaveCriticalSection(&s->cache_lock);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// LibAvW_PlayGetFrameImageScaled
+DLL_EXPORT int LibAvW_PlayGetFrameImageScaled(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	LIBAVW_TRACE_BEGIN(mark);
+	EnterCriticalSection(&s->cache_lock);
+	ret = LibAvW_Stream_GetFrameImage(s, pixel_format, imagedata, imagewidth, imageheight, scaler);
+	LeaveCriticalSection(&s->cache_lock);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// LibAvW_Mip_LevelSize
+// size of mip level, each level halves previous one down to 1x1
+void LibAvW_Mip_LevelSize(int width, int height, int level, int *levelwidth, int *levelheight)
+{
+	*levelwidth = FFMAX(1, width >> level);
+	*levelheight = FFMAX(1, height >> level);
+}
+
+// LibAvW_Mip_NumLevels
+int LibAvW_Mip_NumLevels(int width, int height, int maxlevels)
+{
+	int numlevels;
+
+	for (numlevels = 1; (width >> numlevels) > 0 || (height >> numlevels) > 0; numlevels++);
+	if (maxlevels > 0)
+		numlevels = FFMIN(numlevels, maxlevels);
+	return numlevels;
+}
+
+// LibAvW_Mip_BoxFilter_SSE2
+// 2x2 box filter of 16 source pixels into 8
+void LibAvW_Mip_BoxFilter_SSE2(uint8_t *dst, uint8_t *row0, uint8_t *row1, int count)
+{
+	__m128i zero, ones, two, a, b, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	ones = _mm_set1_epi16(1);
+	two = _mm_set1_epi32(2);
+	for (x = 0; x < count; x += 8, row0 += 16, row1 += 16)
+	{
+		a = _mm_loadu_si128((__m128i *)row0);
+		b = _mm_loadu_si128((__m128i *)row1);
+		lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lo, ones), two), 2);
+		hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(hi, ones), two), 2);
+		lo = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(lo, lo));
+	}
+}
+
+// LibAvW_Mip_BoxFilter
+// halves plane, odd edges are clamped
+void LibAvW_Mip_BoxFilter(uint8_t *dst, int dstlinesize, int dstwidth, int dstheight, uint8_t *src, int srclinesize, int srcwidth, int srcheight)
+{
+	uint8_t *row0, *row1, *d;
+	int x, y, x0, x1, simd;
+	bool sse2;
+
+	sse2 = (av_get_cpu_flags() & AV_CPU_FLAG_SSE2) != 0;
+	for (y = 0; y < dstheight; y++)
+	{
+		row0 = src + FFMIN(y * 2, srcheight - 1) * srclinesize;
+		row1 = src + FFMIN(y * 2 + 1, srcheight - 1) * srclinesize;
+		d = dst + y * dstlinesize;
+		simd = 0;
+		if (sse2 && srcwidth >= dstwidth * 2)
+		{
+			simd = (dstwidth & ~7);
+			LibAvW_Mip_BoxFilter_SSE2(d, row0, row1, simd);
+		}
+		for (x = simd; x < dstwidth; x++)
+		{
+			x0 = FFMIN(x * 2, srcwidth - 1);
+			x1 = FFMIN(x * 2 + 1, srcwidth - 1);
+			d[x] = (uint8_t)((row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2);
+		}
+	}
+}
+
+// LibAvW_Mip_BoxFilterPacked
+// halves packed BGR(A) image, odd edges are clamped
+void LibAvW_Mip_BoxFilterPacked(uint8_t *dst, int dstwidth, int dstheight, const uint8_t *src, int srcwidth, int srcheight, int bpp)
+{
+	const uint8_t *row0, *row1;
+	int x, y, c, x0, x1;
+
+	for (y = 0; y < dstheight; y++)
+	{
+		row0 = src + FFMIN(y * 2, srcheight - 1) * srcwidth * bpp;
+		row1 = src + FFMIN(y * 2 + 1, srcheight - 1) * srcwidth * bpp;
+		for (x = 0; x < dstwidth; x++)
+		{
+			x0 = FFMIN(x * 2, srcwidth - 1) * bpp;
+			x1 = FFMIN(x * 2 + 1, srcwidth - 1) * bpp;
+			for (c = 0; c < bpp; c++)
+				*dst++ = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+}
+
+// LibAvW_Stream_GetFrameMipmaps
+// scales current frame to YUV 4:2:0 level 0, box filters YUV planes level by level
+// and converts each level into the image chain, levels under 8 pixels wide (which
+// swscale does not take) are box filtered from previous output level
+int LibAvW_Stream_GetFrameMipmaps(avwstream_t *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int maxlevels, int scaler)
+{
+	PixelFormat avpixelformat, srcformat, yuvformat;
+	uint8_t **srcdata, *cached, *dst, *prev;
+	int *srclinesize, srcwidth, srcheight, avscaler, numlevels, level, w, h, pw, ph, plane, size, bpp;
+	avwpoolbuffer_t *buf[2];
+	AVPicture cachedpicture, yuv[2], output;
+	SwsContext *scale_context;
+
+	// get pixel format
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+
+	// get scaler
+	if (scaler >= LIBAVW_SCALER_BILINEAR && scaler <= LIBAVW_SCALER_SPLINE)
+		avscaler = libav_scalers[scaler];
+	else
+	{
+		stream->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
+		return 0;
+	}
+	if (imagewidth < 8 || imageheight <= 0)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_FRAME_SIZE;
+		return 0;
+	}
+	bpp = (avpixelformat == PIX_FMT_BGRA) ? 4 : 3;
+
+	// get source picture
+	if (stream->reverse && !stream->cache_playing)
+	{
+		if (!stream->rev_current)
+		{
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return 0;
+		}
+		srcdata = stream->rev_current->picture.data;
+		srclinesize = stream->rev_current->picture.linesize;
+		srcwidth = stream->rev_current->width;
+		srcheight = stream->rev_current->height;
+		srcformat = stream->rev_current->format;
+	}
+	else if ((cached = LibAvW_Cache_GetFrame(stream)) != NULL)
+	{
+		srcformat = LibAvW_GetPixelFormat(stream->cache_pixelformat);
+		avpicture_fill(&cachedpicture, cached, srcformat, stream->cache_width, stream->cache_height);
+		srcdata = cachedpicture.data;
+		srclinesize = cachedpicture.linesize;
+		srcwidth = stream->cache_width;
+		srcheight = stream->cache_height;
+	}
+	else
+	{
+		srcdata = stream->AV_InputFrame->data;
+		srclinesize = stream->AV_InputFrame->linesize;
+		srcwidth = stream->AV_InputFrame->width;
+		srcheight = stream->AV_InputFrame->height;
+		srcformat = (PixelFormat)stream->AV_InputFrame->format;
+	}
+
+	// level 0 in YUV 4:2:0, two buffers are swapped while going down the chain
+	yuvformat = (srcformat == PIX_FMT_YUVJ420P) ? PIX_FMT_YUVJ420P : PIX_FMT_YUV420P;
+	size = avpicture_get_size(yuvformat, imagewidth, imageheight);
+	buf[0] = LibAvW_Pool_Alloc(size);
+	buf[1] = LibAvW_Pool_Alloc(size);
+	if (!buf[0] || !buf[1])
+	{
+		if (buf[0])
+			LibAvW_Pool_Free(buf[0]);
+		if (buf[1])
+			LibAvW_Pool_Free(buf[1]);
+		stream->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+		return 0;
+	}
+	avpicture_fill(&yuv[0], buf[0]->data, yuvformat, imagewidth, imageheight);
+	scale_context = LibAvW_GetScaler(stream, &stream->sws_mip, srcwidth, srcheight, srcformat, imagewidth, imageheight, yuvformat, avscaler);
+	if (!scale_context)
+	{
+		LibAvW_Pool_Free(buf[0]);
+		LibAvW_Pool_Free(buf[1]);
+		stream->lasterror = LIBAVW_ERROR_BAD_SCALER;
+		return 0;
+	}
+	if (!sws_scale(scale_context, srcdata, srclinesize, 0, srcheight, yuv[0].data, yuv[0].linesize))
+	{
+		LibAvW_Pool_Free(buf[0]);
+		LibAvW_Pool_Free(buf[1]);
+		stream->lasterror = LIBAVW_ERROR_APPLYING_SCALE;
+		return 0;
+	}
+
+	// convert level, then filter next one from it
+	numlevels = LibAvW_Mip_NumLevels(imagewidth, imageheight, maxlevels);
+	dst = (uint8_t *)imagedata;
+	prev = NULL;
+	for (level = 0; level < numlevels; level++, prev = dst, dst += avpicture_get_size(avpixelformat, w, h))
+	{
+		LibAvW_Mip_LevelSize(imagewidth, imageheight, level, &w, &h);
+		if (level > 0)
+			LibAvW_Mip_LevelSize(imagewidth, imageheight, level - 1, &pw, &ph);
+
+		// tail of chain comes from previous output level
+		if (level > 0 && (w < 8 || level >= LIBAVW_MIP_CONTEXTS))
+		{
+			LibAvW_Mip_BoxFilterPacked(dst, w, h, prev, pw, ph, bpp);
+			continue;
+		}
+		if (level > 0)
+		{
+			avpicture_fill(&yuv[level & 1], buf[level & 1]->data, yuvformat, w, h);
+			LibAvW_Mip_BoxFilter(yuv[level & 1].data[0], yuv[level & 1].linesize[0], w, h, yuv[(level - 1) & 1].data[0], yuv[(level - 1) & 1].linesize[0], pw, ph);
+			for (plane = 1; plane < 3; plane++)
+				LibAvW_Mip_BoxFilter(yuv[level & 1].data[plane], yuv[level & 1].linesize[plane], (w + 1) >> 1, (h + 1) >> 1, yuv[(level - 1) & 1].data[plane], yuv[(level - 1) & 1].linesize[plane], (pw + 1) >> 1, (ph + 1) >> 1);
+		}
+
+		// every level keeps its own context, sizes stay the same from frame to frame
+		scale_context = LibAvW_GetScaler(stream, &stream->sws_miplevels[level], w, h, yuvformat, w, h, avpixelformat, SWS_POINT);
+		avpicture_fill(&output, dst, avpixelformat, w, h);
+		if (!scale_context || !sws_scale(scale_context, yuv[level & 1].data, yuv[level & 1].linesize, 0, h, output.data, output.linesize))
+		{
+			LibAvW_Pool_Free(buf[0]);
+			LibAvW_Pool_Free(buf[1]);
+			stream->lasterror = scale_context ? LIBAVW_ERROR_APPLYING_SCALE : LIBAVW_ERROR_BAD_SCALER;
+			return 0;
+		}
+	}
+	LibAvW_Pool_Free(buf[0]);
+	LibAvW_Pool_Free(buf[1]);
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return numlevels;
+}
+
+// LibAvW_PlayGetFrameMipmaps
+DLL_EXPORT int LibAvW_PlayGetFrameMipmaps(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int maxlevels, int scaler)
+{
+	avwstream_t *s;
+	int64_t start;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	EnterCriticalSection(&s->cache_lock);
+	if (scaler != LIBAVW_SCALER_AUTO)
+		ret = LibAvW_Stream_GetFrameMipmaps(s, pixel_format, imagedata, imagewidth, imageheight, maxlevels, scaler);
+	else
+	{
+		start = LibAvW_Timer();
+		ret = LibAvW_Stream_GetFrameMipmaps(s, pixel_format, imagedata, imagewidth, imageheight, maxlevels, LibAvW_Stream_AutoScaler(s, scaler));
+		if (ret)
+			LibAvW_Stream_AutoMeasure(s, start);
+	}
+	LeaveCriticalSection(&s->cache_lock);
+	return ret;
+}
+
+// LibAvW_GetMipmapChainSize
+DLL_EXPORT int LibAvW_GetMipmapChainSize(int pixel_format, int width, int height, int maxlevels)
+{
+	PixelFormat avpixelformat;
+	int numlevels, level, w, h, size;
+
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE || width <= 0 || height <= 0)
+		return 0;
+	numlevels = LibAvW_Mip_NumLevels(width, height, maxlevels);
+	for (size = 0, level = 0; level < numlevels; level++)
+	{
+		LibAvW_Mip_LevelSize(width, height, level, &w, &h);
+		size += avpicture_get_size(avpixelformat, w, h);
+	}
+	return size;
+}
+
+// LibAvW_Tile_Copy
+// copies tile at x, y out of image, pixels outside of image repeat its edges
+void LibAvW_Tile_Copy(const uint8_t *image, int imagepitch, int imagewidth, int imageheight, int bpp, uint8_t *tile, int tilepitch, int x, int y, int tilewidth, int tileheight)
+{
+	const uint8_t *line;
+	int row, col, left, inner;
+
+	left = FFMIN(FFMAX(-x, 0), tilewidth);
+	inner = FFMAX(FFMIN(x + tilewidth, imagewidth) - (x + left), 0);
+	for (row = 0; row < tileheight; row++, tile += tilepitch)
+	{
+		line = image + FFMIN(FFMAX(y + row, 0), imageheight - 1) * imagepitch;
+		for (col = 0; col < left; col++)
+			memcpy(tile + col * bpp, line, bpp);
+		if (inner)
+			memcpy(tile + left * bpp, line + (x + left) * bpp, inner * bpp);
+		for (col = left + inner; col < tilewidth; col++)
+			memcpy(tile + col * bpp, line + (imagewidth - 1) * bpp, bpp);
+	}
+}
+
+// LibAvW_Tile_FillEdges
+// repeats edges of region x0, y0 - x1, y1 already written into tile over rest of it
+void LibAvW_Tile_FillEdges(uint8_t *tile, int tilepitch, int bpp, int tilewidth, int tileheight, int x0, int y0, int x1, int y1)
+{
+	uint8_t *line;
+	int row, col;
+
+	for (row = y0; row < y1; row++)
+	{
+		line = tile + row * tilepitch;
+		for (col = 0; col < x0; col++)
+			memcpy(line + col * bpp, line + x0 * bpp, bpp);
+		for (col = x1; col < tilewidth; col++)
+			memcpy(line + col * bpp, line + (x1 - 1) * bpp, bpp);
+	}
+	for (row = 0; row < y0; row++)
+		memcpy(tile + row * tilepitch, tile + y0 * tilepitch, tilewidth * bpp);
+	for (row = y1; row < tileheight; row++)
+		memcpy(tile + row * tilepitch, tile + (y1 - 1) * tilepitch, tilewidth * bpp);
+}
+
+// LibAvW_Stream_GetFrameTiles
+// writes current frame split into tiles, frames of output size in 8-bit planar YUV are converted
+// straight into each tile from offset source planes, cached images are copied out directly,
+// everything else is converted whole and then copied
+int LibAvW_Stream_GetFrameTiles(avwstream_t *stream, int pixel_format, int imagewidth, int imageheight, int tilewidth, int tileheight, int border, void **tiles, int numtiles, int scaler)
+{
+	const AVPixFmtDescriptor *desc;
+	PixelFormat avpixelformat, srcformat;
+	SwsContext *scale_context;
+	uint8_t **srcdata, *srcplanes[4], *dst[4], *cached, *image;
+	int *srclinesize, dstlinesize[4], srcwidth, srcheight;
+	int columns, rows, bpp, pitch, fullwidth, fullheight, tilescaler, avscaler, imagesize;
+	int tile, x, y, x0, y0, x1, y1, sx, sy, plane, c, ret;
+	bool direct;
+	int64_t span, start;
+
+	// check layout
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+	if (imagewidth <= 0 || imageheight <= 0 || tilewidth <= 0 || tileheight <= 0 || border < 0 || !tiles)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_TILES;
+		return 0;
+	}
+	columns = (imagewidth + tilewidth - 1) / tilewidth;
+	rows = (imageheight + tileheight - 1) / tileheight;
+	if (numtiles < columns * rows)
+	{
+		stream->lasterror = LIBAVW_ERROR_BAD_TILES;
+		return 0;
+	}
+	bpp = (avpixelformat == PIX_FMT_BGRA) ? 4 : 3;
+	fullwidth = tilewidth + border * 2;
+	fullheight = tileheight + border * 2;
+	pitch = fullwidth * bpp;
+
+	// get scaler
+	tilescaler = LibAvW_Stream_AutoScaler(stream, scaler);
+	if (tilescaler >= LIBAVW_SCALER_BILINEAR && tilescaler <= LIBAVW_SCALER_SPLINE)
+		avscaler = libav_scalers[tilescaler];
+	else
+	{
+		stream->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
+		return 0;
+	}
+
+	// pick source same way LibAvW_Stream_GetFrameImage does
+	srcdata = NULL;
+	srclinesize = NULL;
+	srcwidth = srcheight = 0;
+	srcformat = PIX_FMT_NONE;
+	if (stream->reverse && !stream->cache_playing)
+	{
+		if (!stream->rev_current)
+		{
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return 0;
+		}
+		srcdata = stream->rev_current->picture.data;
+		srclinesize = stream->rev_current->picture.linesize;
+		srcwidth = stream->rev_current->width;
+		srcheight = stream->rev_current->height;
+		srcformat = stream->rev_current->format;
+	}
+	else if ((cached = LibAvW_Cache_GetFrame(stream)) != NULL)
+	{
+		if (stream->cache_pixelformat == pixel_format && stream->cache_width == imagewidth && stream->cache_height == imageheight && (stream->cache_scaler == tilescaler || scaler == LIBAVW_SCALER_AUTO))
+		{
+			for (tile = 0; tile < columns * rows; tile++)
+				LibAvW_Tile_Copy(cached, imagewidth * bpp, imagewidth, imageheight, bpp, (uint8_t *)tiles[tile], pitch, (tile % columns) * tilewidth - border, (tile / columns) * tileheight - border, fullwidth, fullheight);
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return 1;
+		}
+	}
+	else
+	{
+		srcdata = stream->AV_InputFrame->data;
+		srclinesize = stream->AV_InputFrame->linesize;
+		srcwidth = stream->AV_InputFrame->width;
+		srcheight = stream->AV_InputFrame->height;
+		srcformat = (PixelFormat)stream->AV_InputFrame->format;
+	}
+
+	// tile origins must fall on chroma samples
+	direct = false;
+	desc = srcdata ? av_pix_fmt_desc_get(srcformat) : NULL;
+	if (desc && srcdata[0] && srcwidth == imagewidth && srcheight == imageheight && stream->alphamode == LIBAVW_ALPHA_NONE && (desc->flags & PIX_FMT_PLANAR) && !(desc->flags & (PIX_FMT_RGB | PIX_FMT_PAL)))
+	{
+		direct = !((tilewidth | border) & ((1 << desc->log2_chroma_w) - 1)) && !((tileheight | border) & ((1 << desc->log2_chroma_h) - 1));
+		for (c = 0; c < desc->nb_components; c++)
+			if (desc->comp[c].depth_minus1 != 7 || desc->comp[c].step_minus1 != 0)
+				direct = false;
+		// swscale takes no images narrower than 8 pixels, first and last column are the narrowest
+		if (FFMIN(tilewidth + border, imagewidth) < 8 || imagewidth - (columns - 1) * tilewidth + (columns > 1 ? border : 0) < 8)
+			direct = false;
+	}
+	if (direct)
+	{
+		start = (scaler == LIBAVW_SCALER_AUTO) ? LibAvW_Timer() : 0;
+		dst[1] = dst[2] = dst[3] = NULL;
+		dstlinesize[0] = pitch;
+		dstlinesize[1] = dstlinesize[2] = dstlinesize[3] = 0;
+		for (tile = 0; tile < columns * rows; tile++)
+		{
+			// part of tile inside image
+			x = (tile % columns) * tilewidth - border;
+			y = (tile / columns) * tileheight - border;
+			x0 = FFMAX(-x, 0);
+			y0 = FFMAX(-y, 0);
+			x1 = FFMIN(imagewidth - x, fullwidth);
+			y1 = FFMIN(imageheight - y, fullheight);
+			for (plane = 0; plane < 4; plane++)
+			{
+				sx = (plane == 1 || plane == 2) ? ((x + x0) >> desc->log2_chroma_w) : (x + x0);
+				sy = (plane == 1 || plane == 2) ? ((y + y0) >> desc->log2_chroma_h) : (y + y0);
+				srcplanes[plane] = srcdata[plane] ? (srcdata[plane] + sy * srclinesize[plane] + sx) : NULL;
+			}
+
+			// tiles of same position class share size and scale context
+			scale_context = LibAvW_GetScaler(stream, &stream->sws_tiles[(x0 ? 0 : (x1 < fullwidth ? 2 : 1)) * 3 + (y0 ? 0 : (y1 < fullheight ? 2 : 1))], x1 - x0, y1 - y0, srcformat, x1 - x0, y1 - y0, avpixelformat, avscaler);
+			if (!scale_context)
+			{
+				stream->lasterror = LIBAVW_ERROR_BAD_SCALER;
+				return 0;
+			}
+			dst[0] = (uint8_t *)tiles[tile] + y0 * pitch + x0 * bpp;
+			span = LibAvW_Span_Begin();
+			ret = sws_scale(scale_context, srcplanes, srclinesize, 0, y1 - y0, dst, dstlinesize);
+			LibAvW_Span_End("convert", stream, span);
+			if (!ret)
+			{
+				stream->lasterror = LIBAVW_ERROR_APPLYING_SCALE;
+				return 0;
+			}
+			LibAvW_Tile_FillEdges((uint8_t *)tiles[tile], pitch, bpp, fullwidth, fullheight, x0, y0, x1, y1);
+		}
+		if (scaler == LIBAVW_SCALER_AUTO)
+			LibAvW_Stream_AutoMeasure(stream, start);
+		stream->lasterror = LIBAVW_ERROR_NONE;
+		return 1;
+	}
+
+	// scaled, alpha-packed or other source formats, full frame is kept for next calls
+	imagesize = avpicture_get_size(avpixelformat, imagewidth, imageheight);
+	if (imagesize > stream->tile_imagesize)
+	{
+		if (!LibAvW_Memory_Fits(imagesize - stream->tile_imagesize))
+		{
+			stream->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+			return 0;
+		}
+		image = (uint8_t *)realloc(stream->tile_image, imagesize);
+		if (!image)
+		{
+			stream->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
+			return 0;
+		}
+		LIBAVW_TRACE_ALLOC(imagesize);
+		LibAvW_Memory_Add(stream, &stream->memory.tiles, &libav_memory.tiles, imagesize - stream->tile_imagesize);
+		stream->tile_image = image;
+		stream->tile_imagesize = imagesize;
+	}
+	ret = LibAvW_Stream_GetFrameImage(stream, pixel_format, stream->tile_image, imagewidth, imageheight, scaler);
+	if (ret)
+		for (tile = 0; tile < columns * rows; tile++)
+			LibAvW_Tile_Copy(stream->tile_image, imagewidth * bpp, imagewidth, imageheight, bpp, (uint8_t *)tiles[tile], pitch, (tile % columns) * tilewidth - border, (tile / columns) * tileheight - border, fullwidth, fullheight);
+	return ret;
+}
+
+// LibAvW_PlayGetFrameTiles
+DLL_EXPORT int LibAvW_PlayGetFrameTiles(void *stream, int pixel_format, int imagewidth, int imageheight, int tilewidth, int tileheight, int border, void **tiles, int numtiles, int scaler)
+{
+	avwstream_t *s;
+	avwtracemark_t mark;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	LIBAVW_TRACE_BEGIN(mark);
+	EnterCriticalSection(&s->cache_lock);
+	ret = LibAvW_Stream_GetFrameTiles(s, pixel_format, imagewidth, imageheight, tilewidth, tileheight, border, tiles, numtiles, scaler);
+	LeaveCriticalSection(&s->cache_lock);
+	LIBAVW_TRACE_CALL(s, mark);
+	return ret;
+}
+
+// frame handle given out by LibAvW_AcquireFrame
+typedef struct avwframe_s
+{
+	avwframeinfo_t   info;
+	avwpoolbuffer_t *buf;
+}avwframe_t;
+
+// idle scale contexts of held frame conversion, shared by all threads
+#define LIBAVW_FRAME_SCALERS 8
+typedef struct avwframescaler_s
+{
+	avwscalecontext_t scale;
+	int              srcwidth;
+	int              srcheight;
+	int              srcformat;
+	int              dstwidth;
+	int              dstheight;
+	int              dstformat;
+	int              avscaler;
+}avwframescaler_t;
+
+CRITICAL_SECTION  libav_frame_scalers_lock;
+avwframescaler_t  libav_frame_scalers[LIBAVW_FRAME_SCALERS];
+
+// LibAvW_FrameScaler_Take
+// takes idle context of same conversion out of the cache, or any idle one to be rebuilt
+void LibAvW_FrameScaler_Take(avwframescaler_t *fs)
+{
+	avwframescaler_t *slot, *found;
+	int i;
+
+	found = NULL;
+	EnterCriticalSection(&libav_frame_scalers_lock);
+	for (i = 0; i < LIBAVW_FRAME_SCALERS; i++)
+	{
+		slot = &libav_frame_scalers[i];
+		if (!slot->scale.context)
+			continue;
+		if (slot->srcwidth == fs->srcwidth && slot->srcheight == fs->srcheight && slot->srcformat == fs->srcformat && slot->dstwidth == fs->dstwidth && slot->dstheight == fs->dstheight && slot->dstformat == fs->dstformat && slot->avscaler == fs->avscaler)
+		{
+			found = slot;
+			break;
+		}
+		if (!found)
+			found = slot;
+	}
+	if (found)
+	{
+		fs->scale = found->scale;
+		found->scale.context = NULL;
+		found->scale.bytes = 0;
+	}
+	else
+	{
+		fs->scale.context = NULL;
+		fs->scale.bytes = 0;
+	}
+	LeaveCriticalSection(&libav_frame_scalers_lock);
+}
+
+// LibAvW_FrameScaler_Put
+// returns context to the cache, frees it if cache is full
+void LibAvW_FrameScaler_Put(avwframescaler_t *fs)
+{
+	int i;
+
+	if (!fs->scale.context)
+		return;
+	EnterCriticalSection(&libav_frame_scalers_lock);
+	for (i = 0; i < LIBAVW_FRAME_SCALERS; i++)
+	{
+		if (!libav_frame_scalers[i].scale.context)
+		{
+			libav_frame_scalers[i] = *fs;
+			LeaveCriticalSection(&libav_frame_scalers_lock);
+			return;
+		}
+	}
+	LeaveCriticalSection(&libav_frame_scalers_lock);
+	sws_freeContext(fs->scale.context);
+	LibAvW_Memory_AddGlobal(&libav_memory.scalers, -fs->scale.bytes);
+}
+
+// LibAvW_Stream_AcquireFrame
+// returns handle of presented frame, decoder pool buffers are shared,
+// frames decoded elsewhere are copied into a pool buffer once
+avwframe_t *LibAvW_Stream_AcquireFrame(avwstream_t *stream)
+{
+	avwframe_t *frame;
+	AVPicture picture, cachedpicture;
+	PixelFormat format;
+	uint8_t *cached;
+	int i;
+
+	frame = (avwframe_t *)malloc(sizeof(avwframe_t));
+	if (!frame)
+	{
+		stream->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
+		return NULL;
+	}
+	LIBAVW_TRACE_ALLOC(sizeof(avwframe_t));
+	memset(frame, 0, sizeof(avwframe_t));
+	frame->info.pts = LibAvW_Stream_CurrentTime(stream);
+
+	// reverse playback buffer
+	if (stream->reverse && !stream->cache_playing)
+	{
+		if (!stream->rev_current)
+		{
+			free(frame);
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return NULL;
+		}
+		frame->buf = stream->rev_current->buf;
+		LibAvW_Pool_Ref(frame->buf);
+		picture = stream->rev_current->picture;
+		frame->info.width = stream->rev_current->width;
+		frame->info.height = stream->rev_current->height;
+		frame->info.format = stream->rev_current->format;
+		frame->info.duration = stream->rev_current->duration;
+	}
+	// frame cache holds converted images
+	else if ((cached = LibAvW_Cache_GetFrame(stream)) != NULL)
+	{
+		format = LibAvW_GetPixelFormat(stream->cache_pixelformat);
+		frame->buf = LibAvW_Pool_Alloc(stream->cache_imagesize);
+		if (!frame->buf)
+		{
+			free(frame);
+			stream->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+			return NULL;
+		}
+		LibAvW_Pool_Hold(frame->buf);
+		memcpy(frame->buf->data, cached, stream->cache_imagesize);
+		avpicture_fill(&picture, frame->buf->data, format, stream->cache_width, stream->cache_height);
+		frame->info.width = stream->cache_width;
+		frame->info.height = stream->cache_height;
+		frame->info.format = format;
+		frame->info.duration = stream->frame_duration;
+	}
+	else
+	{
+		if (stream->framenum <= 0 || !stream->AV_InputFrame || !stream->AV_InputFrame->data[0])
+		{
+			free(frame);
+			stream->lasterror = LIBAVW_ERROR_NONE;
+			return NULL;
+		}
+		frame->info.width = stream->AV_InputFrame->width;
+		frame->info.height = stream->AV_InputFrame->height;
+		frame->info.format = stream->AV_InputFrame->format;
+		frame->info.duration = stream->frame_duration;
+		for (i = 0; i < 4; i++)
+		{
+			picture.data[i] = stream->AV_InputFrame->data[i];
+			picture.linesize[i] = stream->AV_InputFrame->linesize[i];
+		}
+		if (stream->AV_InputFrame->type == FF_BUFFER_TYPE_USER && stream->AV_InputFrame->opaque)
+		{
+			// decoder writes next frames into other buffers
+			frame->buf = (avwpoolbuffer_t *)stream->AV_InputFrame->opaque;
+			LibAvW_Pool_Ref(frame->buf);
+		}
+		else
+		{
+			// codec owns its buffers
+			frame->buf = LibAvW_Pool_Alloc(avpicture_get_size((PixelFormat)frame->info.format, frame->info.width, frame->info.height));
+			if (!frame->buf)
+			{
+				free(frame);
+				stream->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+				return NULL;
+			}
+			LibAvW_Pool_Hold(frame->buf);
+			avpicture_fill(&cachedpicture, frame->buf->data, (PixelFormat)frame->info.format, frame->info.width, frame->info.height);
+			av_picture_copy(&cachedpicture, &picture, (PixelFormat)frame->info.format, frame->info.width, frame->info.height);
+			picture = cachedpicture;
+		}
+	}
+	for (i = 0; i < 4; i++)
+	{
+		frame->info.data[i] = picture.data[i];
+		frame->info.linesize[i] = picture.linesize[i];
+	}
+	stream->lasterror = LIBAVW_ERROR_NONE;
+	return frame;
+}
+
+// LibAvW_AcquireFrame
+DLL_EXPORT void *LibAvW_AcquireFrame(void *stream, avwframeinfo_t *info)
+{
+	avwstream_t *s;
+	avwframe_t *frame;
+
+	// check
+	if (!libav_initialized)
+		return NULL;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return NULL;
+
+	EnterCriticalSection(&s->cache_lock);
+	frame = LibAvW_Stream_AcquireFrame(s);
+	LeaveCriticalSection(&s->cache_lock);
+	if (frame && info)
+		*info = frame->info;
+	return frame;
+}
+
+// LibAvW_ReleaseFrame
+DLL_EXPORT void LibAvW_ReleaseFrame(void *frame)
+{
+	avwframe_t *f;
+
+	if (!libav_initialized)
+		return;
+	f = (avwframe_t *)frame;
+	if (!f)
+		return;
+	LibAvW_Pool_Free(f->buf);
+	free(f);
+}
+
+// LibAvW_FrameGetImage
+DLL_EXPORT int LibAvW_FrameGetImage(void *frame, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
+{
+	avwframe_t *f;
+	PixelFormat avpixelformat;
+	avwframescaler_t fs;
+	SwsContext *scale_context;
+	AVPicture output;
+	int ret, bytes;
+
+	if (!libav_initialized)
+		return 0;
+	f = (avwframe_t *)frame;
+	if (!f)
+		return 0;
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	scaler = LibAvW_Stream_AutoScaler(NULL, scaler);
+	if (avpixelformat == PIX_FMT_NONE || scaler < LIBAVW_SCALER_BILINEAR || scaler > LIBAVW_SCALER_SPLINE)
+		return 0;
+
+	// frames are read-only, any number of threads may convert the same frame,
+	// each conversion holds its own scale context taken from shared cache
+	avpicture_fill(&output, (uint8_t *)imagedata, avpixelformat, imagewidth, imageheight);
+	fs.srcwidth = f->info.width;
+	fs.srcheight = f->info.height;
+	fs.srcformat = f->info.format;
+	fs.dstwidth = imagewidth;
+	fs.dstheight = imageheight;
+	fs.dstformat = avpixelformat;
+	fs.avscaler = libav_scalers[scaler];
+	LibAvW_FrameScaler_Take(&fs);
+	scale_context = sws_getCachedContext(fs.scale.context, fs.srcwidth, fs.srcheight, (PixelFormat)fs.srcformat, fs.dstwidth, fs.dstheight, avpixelformat, fs.avscaler, NULL, NULL, NULL);
+	if (scale_context != fs.scale.context)
+	{
+		bytes = scale_context ? LibAvW_ScalerSize(fs.srcwidth, fs.srcheight, fs.dstwidth, fs.dstheight, fs.avscaler) : 0;
+		LibAvW_Memory_AddGlobal(&libav_memory.scalers, bytes - fs.scale.bytes);
+		fs.scale.context = scale_context;
+		fs.scale.bytes = bytes;
+	}
+	if (!scale_context)
+		return 0;
+	ret = sws_scale(scale_context, f->info.data, f->info.linesize, 0, f->info.height, output.data, output.linesize) ? 1 : 0;
+	LibAvW_FrameScaler_Put(&fs);
+	return ret;
+}
+
+// LibAvW_PlayFrameJob
+// advances single stream of a LibAvW_PlayFrames batch
+void LibAvW_PlayFrameJob(void *data, int index)
+{
+	avwframerequest_t *request = (avwframerequest_t *)data + index;
+	avwstream_t *s = (avwstream_t *)request->stream;
+	int64_t framenum;
+	bool newframe;
+	int ret;
+
+	if (!s)
+	{
+		request->status = LIBAVW_BATCH_ERROR;
+		request->error = LIBAVW_ERROR_NULL_STREAM;
+		return;
+	}
+
+	// prefetch thread of reverse playback can't be shared with workers
+	if (s->reverse && !s->cache_playing)
+	{
+		request->status = LIBAVW_BATCH_ERROR;
+		request->error = LIBAVW_ERROR_BATCH_REVERSE;
+		return;
+	}
+
+	// decode up to frame that covers requested time, non-blocking streams leave the worker
+	// when data is not there (worker resumes pending frame of earlier call the same way)
+	framenum = (int64_t)(request->time * s->framerate) + 1;
+	newframe = false;
+	ret = LIBAVW_PLAY_FRAME;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	while(s->io_inside || s->framenum < framenum)
+	{
+		ret = LibAvW_Stream_StepFrame(s);
+		if (ret != LIBAVW_PLAY_FRAME)
+			break;
+		newframe = true;
+	}
+	if (s->lasterror != LIBAVW_ERROR_NONE)
+	{
+		request->status = LIBAVW_BATCH_ERROR;
+		request->error = s->lasterror;
+		return;
+	}
+	if (!newframe)
+	{
+		if (ret == LIBAVW_PLAY_PENDING)
+			request->status = LIBAVW_BATCH_PENDING;
+		else
+			request->status = (s->framenum < framenum) ? LIBAVW_BATCH_END : LIBAVW_BATCH_NOFRAME;
+		request->error = LIBAVW_ERROR_NONE;
+		return;
+	}
+
+	// convert
+	EnterCriticalSection(&s->cache_lock);
+	ret = request->imagedata ? LibAvW_Stream_GetFrameImage(s, request->pixel_format, request->imagedata, request->imagewidth, request->imageheight, request->scaler) : 1;
+	LeaveCriticalSection(&s->cache_lock);
+	if (!ret)
+	{
+		request->status = LIBAVW_BATCH_ERROR;
+		request->error = s->lasterror;
+		return;
+	}
+	request->status = LIBAVW_BATCH_NEWFRAME;
+	request->error = LIBAVW_ERROR_NONE;
+	LibAvW_Stream_FrameReady(s);
+}
+
+// LibAvW_PlayFrames
+DLL_EXPORT int LibAvW_PlayFrames(avwframerequest_t *requests, int numrequests)
+{
+	int i, numframes;
+
+	// check
+	if (!libav_initialized || !requests || numrequests <= 0)
+		return 0;
+
+	LibAvW_RunJobs(LibAvW_PlayFrameJob, requests, numrequests);
+	numframes = 0;
+	for (i = 0; i < numrequests; i++)
+		if (requests[i].status == LIBAVW_BATCH_NEWFRAME)
+			numframes++;
+	return numframes;
+}
+
+// LibAvW_PlayGetFlipbook
+DLL_EXPORT int LibAvW_PlayGetFlipbook(void *stream, int pixel_format, void *atlasdata, int atlaswidth, int atlasheight, int cellwidth, int cellheight, int framestep, int scaler, avwflipbookrect_t *rects, int maxrects)
+{
+	avwstream_t *s;
+	PixelFormat avpixelformat;
+	avwpoolbuffer_t *cell;
+	int avscaler, bpp, columns, rows, numcells, numrects, x, y, row, error;
+	bool wasreverse, wascached, played;
+	int64_t framenum;
+	double time;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	// get pixel format
+	avpixelformat = LibAvW_GetPixelFormat(pixel_format);
+	if (avpixelformat == PIX_FMT_NONE)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+	bpp = (avpixelformat == PIX_FMT_BGRA) ? 4 : 3;
+
+	// get scaler
+	scaler = LibAvW_Stream_AutoScaler(s, scaler);
+	if (scaler >= LIBAVW_SCALER_BILINEAR && scaler <= LIBAVW_SCALER_SPLINE)
+		avscaler = libav_scalers[scaler];
+	else
+	{
+		s->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
+		return 0;
+	}
+
+	// get atlas layout
+	if (cellwidth <= 0 || cellheight <= 0)
+	{
+		cellwidth = LibAvW_StreamGetVideoWidth(s);
+		cellheight = LibAvW_StreamGetVideoHeight(s);
+	}
+	if (framestep < 1)
+		framestep = 1;
+	columns = (cellwidth > 0) ? atlaswidth / cellwidth : 0;
+	rows = (cellheight > 0) ? atlasheight / cellheight : 0;
+	numcells = FFMIN(columns * rows, maxrects);
+	if (!atlasdata || !rects || numcells <= 0)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_FRAME_SIZE;
+		return 0;
+	}
+
+	// playback state is restored afterwards
+	wasreverse = s->reverse;
+	wascached = s->cache_playing;
+	framenum = s->framenum;
+	time = LibAvW_Stream_CurrentTime(s);
+	played = (wasreverse && !wascached) ? (s->rev_current != NULL) : (framenum > 0);
+
+	// decoder is needed here, reverse prefetch must let go of it
+	if (!wascached)
+		LibAvW_Reverse_Stop(s);
+	s->cache_playing = false;
+	if (!LibAvW_Stream_Rewind(s))
+	{
+		s->cache_playing = wascached;
+		s->framenum = framenum;
+		return 0;
+	}
+
+	// decode from the start, every frame is converted with stream settings (alpha mode) and put into its cell
+	cell = LibAvW_Pool_Alloc(avpicture_get_size(avpixelformat, cellwidth, cellheight));
+	if (!cell)
+	{
+		s->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+		return 0;
+	}
+	numrects = 0;
+	while(numrects < numcells && LibAvW_Stream_DecodeFrame(s))
+	{
+		if ((s->framenum - 1) % framestep)
+			continue;
+		if (!LibAvW_Stream_ConvertFrame(s, s->AV_InputFrame->data, s->AV_InputFrame->linesize, s->AV_InputFrame->width, s->AV_InputFrame->height, (PixelFormat)s->AV_InputFrame->format, avpixelformat, cell->data, cellwidth, cellheight, avscaler))
+			break;
+		x = (numrects % columns) * cellwidth;
+		y = (numrects / columns) * cellheight;
+		for (row = 0; row < cellheight; row++)
+			memcpy((uint8_t *)atlasdata + ((y + row) * atlaswidth + x) * bpp, cell->data + row * cellwidth * bpp, cellwidth * bpp);
+		rects[numrects].x = x;
+		rects[numrects].y = y;
+		rects[numrects].width = cellwidth;
+		rects[numrects].height = cellheight;
+		rects[numrects].time = s->frame_pts;
+		numrects++;
+	}
+	LibAvW_Pool_Free(cell);
+	error = s->lasterror;
+
+	// bring stream back to where it was, in same mode
+	if (wascached)
+	{
+		s->cache_playing = true;
+		s->framenum = framenum;
+		s->frame_duration = 1.0 / s->framerate;
+		s->frame_pts = (double)FFMAX(framenum - 1, 0) * s->frame_duration;
+	}
+	else
+	{
+		if (played)
+			LibAvW_Stream_SeekTime(s, time);
+		else
+			LibAvW_Stream_Rewind(s);
+		if (wasreverse)
+			LibAvW_Stream_SetReverse(s, true);
+	}
+	if (error != LIBAVW_ERROR_NONE)
+	{
+		s->lasterror = error;
+		return 0;
+	}
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return numrects;
+}
+
+// IO wrapper
+int LibAvW_FS_Read(void *opaque, uint8_t *buf, int buf_size)
+{
+	avwstream_t *s = (avwstream_t *)opaque;
+	int64_t span;
+	int ret;
+
+	// would-block reads leave the decoding fiber, or are retried outside of it
+	// (demux and reverse prefetch threads)
+	for (;;)
+	{
+		span = LibAvW_Span_Begin();
+		ret = s->IO_Read(s->file, buf, buf_size);
+		LibAvW_Span_End("read", s, span);
+		if (ret != LIBAVW_IO_WOULDBLOCK)
+			return ret;
+		if (LibAvW_Stream_InIoFiber(s))
+		{
+			if (s->io_abort)
+				return AVERROR_EXIT;
+			SwitchToFiber(s->io_caller);
+		}
+		else if (s->demux_thread && s->demux_quit && s->demux_abort)
+			return AVERROR_EXIT; // demux thread is being stopped before seek, don't wait for data
+		else
+			Sleep(1);
+	}
+}
+
+int64_t LibAvW_FS_Seek(void *opaque, int64_t pos, int whence)
+{
+	avwstream_t *s = (avwstream_t *)opaque;
+
+	if (whence == AVSEEK_SIZE)
+	{
+		if (s->IO_SeekSize)
+			return s->IO_SeekSize(s->file);
+		return -1;
+	}
+	if (whence == AVSEEK_FORCE)
+		return -1;
+
+	return s->IO_Seek(s->file, pos, whence);
+}
+
+// memory file I/O
+int LibAvW_MEM_Read(void *opaque, uint8_t *buf, int buf_size)
+{
+	avwstream_t *s = (avwstream_t *)opaque;
+	int64_t left = s->memfile_size - s->memfile_pos;
+
+	if (left <= 0)
+		return 0;
+	if (buf_size > left)
+		buf_size = (int)left;
+	memcpy(buf, s->memfile + s->memfile_pos, buf_size);
+	s->memfile_pos += buf_size;
+	return buf_size;
+}
+
+int64_t LibAvW_MEM_Seek(void *opaque, int64_t pos, int whence)
+{
+	avwstream_t *s = (avwstream_t *)opaque;
+
+	whence &= ~AVSEEK_FORCE;
+	if (whence == AVSEEK_SIZE)
+		return s->memfile_size;
+	if (whence == SEEK_CUR)
+		pos += s->memfile_pos;
+	else if (whence == SEEK_END)
+		pos += s->memfile_size;
+	else if (whence != SEEK_SET)
+		return -1;
+	if (pos < 0 || pos > s->memfile_size)
+		return -1;
+	s->memfile_pos = pos;
+	return pos;
+}
+
+// LibAvW_LoadMemoryFile
+// reads whole file into memory if it is small enough, returns false if file should be streamed
+bool LibAvW_LoadMemoryFile(avwstream_t *s)
+{
+	int64_t size, pos;
+	int read;
+
+	if (libav_memfile_limit <= 0 || !s->IO_SeekSize)
+		return false;
+	size = s->IO_SeekSize(s->file);
+	if (size <= 0 || size > libav_memfile_limit || !LibAvW_Memory_Fits(size))
+		return false;
+	if (s->IO_Seek(s->file, 0, SEEK_SET) < 0)
+		return false;
+	s->memfile = (unsigned char *)av_malloc((size_t)size + FF_INPUT_BUFFER_PADDING_SIZE);
+	if (!s->memfile)
+		return false;
+	memset(s->memfile + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+	for (pos = 0; pos < size; pos += read)
+	{
+		read = s->IO_Read(s->file, s->memfile + pos, (int)FFMIN(size - pos, 1 << 20));
+		if (read <= 0)
+		{
+			// short read, stream it instead
+			av_free(s->memfile);
+			s->memfile = NULL;
+			s->IO_Seek(s->file, 0, SEEK_SET);
+			return false;
+		}
+	}
+	s->memfile_size = size;
+	s->memfile_pos = 0;
+	LibAvW_Memory_Add(s, &s->memory.memfiles, &libav_memory.memfiles, size + FF_INPUT_BUFFER_PADDING_SIZE);
+	return true;
+}
+
+// LibAvW_Stream_Open
+// opens file and video decoder, flags are LIBAVW_OPEN_*
+#define LIBAVW_OPEN_FASTPROBE 1 // probe as little of the file as possible
+int LibAvW_Stream_Open(avwstream_t *s, void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize, int flags)
+{
+	unsigned char *inputbuf;
+	unsigned int i;
+	int64_t span;
+	bool lowres, full;
+	int ret;
+
+	// reset stream
+	LibAvW_ResetStream(s);
+
+	// check memory limit, caches are dropped and decoding resolution is lowered before refusing to play
+	lowres = false;
+	if (libav_memory_limit > 0 && !LibAvW_Memory_Fits(0))
+	{
+		LibAvW_Cache_DropOthers(s);
+		LibAvW_Pool_Trim();
+		lowres = true;
+		full = !LibAvW_Memory_Fits(0);
+		if (full)
+		{
+			s->lasterror = LIBAVW_ERROR_MEMORY_LIMIT;
+			return 0;
+		}
+	}
+
+	// set I/O functions
 	s->file = file;
 	s->IO_Read = IoRead;
 	s->IO_Seek = IoSeek;
@@ -393,29 +4654,49 @@ DLL_EXPORT int LibAvW_PlayVideo(void *stream, void *file, avwCallbackIoRead *IoR
 		s->lasterror = LIBAVW_ERROR_ALLOC_INPUT_BUFFER;
 		return 0;
 	}
+	LibAvW_Memory_Add(s, &s->memory.iobuffers, &libav_memory.iobuffers, AV_IOBUFSIZE + FF_INPUT_BUFFER_PADDING_SIZE);
 	s->AV_FormatContext = avformat_alloc_context();
-	s->AV_InputContext = avio_alloc_context(inputbuf, AV_IOBUFSIZE, 0, s, LibAvW_FS_Read, NULL, LibAvW_FS_Seek);
+	if (LibAvW_LoadMemoryFile(s))
+		s->AV_InputContext = avio_alloc_context(inputbuf, AV_IOBUFSIZE, 0, s, LibAvW_MEM_Read, NULL, LibAvW_MEM_Seek);
+	else
+		s->AV_InputContext = avio_alloc_context(inputbuf, AV_IOBUFSIZE, 0, s, LibAvW_FS_Read, NULL, LibAvW_FS_Seek);
 	s->AV_FormatContext->pb = s->AV_InputContext;
+	if (flags & LIBAVW_OPEN_FASTPROBE)
+	{
+		s->AV_FormatContext->probesize = 32768;
+		s->AV_FormatContext->max_analyze_duration = AV_TIME_BASE / 10;
+		s->AV_FormatContext->fps_probe_size = 1;
+	}
 
-	// open input
-    if (avformat_open_input(&s->AV_FormatContext, "tmp", NULL, NULL) != 0)
+	// open input, demuxer of known file is not probed again
+    if (avformat_open_input(&s->AV_FormatContext, "tmp", LibAvW_Probe_Format(s->identity), NULL) != 0)
 	{
 		LibAvW_ResetStream(s);
 		s->lasterror = LIBAVW_ERROR_OPEN_INPUT;
 		return 0;
 	}
 
-    // get stream information
+    // get stream information (from probe cache for known file)
+	span = LibAvW_Span_Begin();
+	if (!LibAvW_Probe_Restore(s->identity, s->AV_FormatContext))
+	{
 #ifdef LIBAV95
-	if (avformat_find_stream_info(s->AV_FormatContext, NULL) < 0)
+		ret = avformat_find_stream_info(s->AV_FormatContext, NULL);
 #else
-	 if (av_find_stream_info(s->AV_FormatContext) < 0)
+		ret = av_find_stream_info(s->AV_FormatContext);
 #endif
-	{
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_FIND_STREAM_INFO;
-		return 0;
+		LibAvW_Span_End("probe", s, span);
+		if (ret < 0)
+		{
+			LibAvW_ResetStream(s);
+			s->lasterror = LIBAVW_ERROR_FIND_STREAM_INFO;
+			return 0;
+		}
+		if (!(flags & LIBAVW_OPEN_FASTPROBE))
+			LibAvW_Probe_Store(s->identity, s->AV_FormatContext);
 	}
+	else
+		LibAvW_Span_End("probe", s, span);
 
     // find the first video stream
     s->AV_VideoStreamId = -1;
@@ -434,80 +4715,468 @@ DLL_EXPORT int LibAvW_PlayVideo(void *stream, void *file, avwCallbackIoRead *IoR
 		LibAvW_ResetStream(s);
 		s->lasterror = LIBAVW_ERROR_FIND_VIDEO_STREAM;
 		return 0;
-	}
-    s->AV_CodecContext = s->AV_FormatContext->streams[s->AV_VideoStreamId]->codec;
+	}
+    s->AV_CodecContext = s->AV_FormatContext->streams[s->AV_VideoStreamId]->codec;
+
+    // allocate UWV video AV_InputFrame
+	// get required buffer size and allocate buffer
+    // assign appropriate parts of buffer to image planes
+	if (s->AV_InputFrame)
+		avcodec_get_frame_defaults(s->AV_InputFrame);
+	else
+		s->AV_InputFrame = avcodec_alloc_frame();
+	if (!s->AV_InputFrame)
+	{
+		LibAvW_ResetStream(s);
+		s->lasterror = LIBAVW_ERROR_ALLOC_INPUT_FRAME;
+        return 0;
+	}
+
+	// allocate output RGBA AV_InputFrame
+	if (s->AV_OutputFrame)
+		avcodec_get_frame_defaults(s->AV_OutputFrame);
+	else
+		s->AV_OutputFrame = avcodec_alloc_frame();
+	if (!s->AV_OutputFrame)
+	{
+		LibAvW_ResetStream(s);
+		s->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
+        return 0;
+	}
+
+	// keyframes only for scrubbing
+	if (s->decodemode == LIBAVW_DECODE_KEYFRAMES)
+		s->AV_CodecContext->skip_frame = AVDISCARD_NONKEY;
+
+	// all right
+	s->framenum = 0;
+	s->framewidth = s->AV_CodecContext->width;
+	s->frameheight = s->AV_CodecContext->height;
+	s->numframes = s->AV_FormatContext->streams[s->AV_VideoStreamId]->nb_frames;
+
+	// determine framerate
+	s->framerate = (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->avg_frame_rate.num / (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->avg_frame_rate.den;
+	if (s->framerate <= 1.0f || s->framerate > 100.0f)
+	{
+		s->framerate = (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->r_frame_rate.num / (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->r_frame_rate.den;
+		if (s->framerate <= 1.0f || s->framerate > 100.0f)
+			s->framerate = 15;
+	}
+
+	// final checks
+	if (s->framewidth <= 0 || s->frameheight <= 0)
+	{
+		LibAvW_ResetStream(s);
+		s->lasterror = LIBAVW_ERROR_BAD_FRAME_SIZE;
+        return 0;
+	}
+
+	// file played before, frames come from its disk cache and decoder is opened only when needed
+	s->lowres = lowres;
+	if (!LibAvW_Disk_Map(s) && !LibAvW_Stream_OpenCodec(s))
+	{
+		ret = s->lasterror;
+		LibAvW_ResetStream(s);
+		s->lasterror = ret;
+		return 0;
+	}
+
+	// allright
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_PlayVideo
+DLL_EXPORT int LibAvW_PlayVideo(void *stream, void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize)
+{
+	avwstream_t *s;
+	int64_t span;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	span = LibAvW_Span_Begin();
+	ret = LibAvW_Stream_Open(s, file, IoRead, IoSeek, IoSeekSize, 0);
+	LibAvW_Span_End("open", s, span);
+	return ret;
+}
+
+// LibAvW_ExtractThumbnail
+DLL_EXPORT int LibAvW_ExtractThumbnail(void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize, double time, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler)
+{
+	avwstream_t *s;
+	AVStream *st;
+	int64_t ts;
+	int error;
+
+	// check
+	if (!libav_initialized)
+		return LIBAVW_ERROR_LIB_NOT_INITIALIZED;
+	s = (avwstream_t *)malloc(sizeof(avwstream_t));
+	if (s == NULL)
+		return LIBAVW_ERROR_ALLOC_STREAM;
+	memset(s, 0, sizeof(avwstream_t));
+	InitializeCriticalSection(&s->cache_lock);
+
+	// open with minimal probing and decode keyframes only
+	if (LibAvW_Stream_Open(s, file, IoRead, IoSeek, IoSeekSize, LIBAVW_OPEN_FASTPROBE))
+	{
+		s->AV_CodecContext->skip_frame = AVDISCARD_NONKEY;
+		if (time > 0)
+		{
+			st = s->AV_FormatContext->streams[s->AV_VideoStreamId];
+			ts = (int64_t)(time / av_q2d(st->time_base));
+			if (st->start_time != (int64_t)AV_NOPTS_VALUE)
+				ts += st->start_time;
+			if (av_seek_frame(s->AV_FormatContext, s->AV_VideoStreamId, ts, AVSEEK_FLAG_BACKWARD) >= 0)
+				avcodec_flush_buffers(s->AV_CodecContext);
+		}
+		if (!LibAvW_Stream_DecodeFrame(s))
+		{
+			if (s->lasterror == LIBAVW_ERROR_NONE)
+				s->lasterror = LIBAVW_ERROR_DECODING_VIDEO_FRAME;
+		}
+		else
+			LibAvW_Stream_GetFrameImage(s, pixel_format, imagedata, imagewidth, imageheight, scaler);
+	}
+	error = s->lasterror;
+
+	// free
+	LibAvW_ResetStream(s);
+	if (s->AV_InputFrame)
+		av_free(s->AV_InputFrame);
+	if (s->AV_OutputFrame)
+		av_free(s->AV_OutputFrame);
+	LibAvW_Stream_FreeScalers(s);
+	DeleteCriticalSection(&s->cache_lock);
+	free(s);
+	return error;
+}
+
+// LibAvW_StreamSetReverse
+DLL_EXPORT int LibAvW_StreamSetReverse(void *stream, int reverse)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return LibAvW_Stream_SetReverse(s, reverse ? true : false);
+}
+
+// LibAvW_StreamSetDiskCache
+DLL_EXPORT int LibAvW_StreamSetDiskCache(void *stream, const char *path, int pixel_format, int imagewidth, int imageheight, int scaler)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+	if (!path)
+		path = "";
+	if (strlen(path) >= MAX_PATH - 4)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_DISK_CACHE_PATH;
+		return 0;
+	}
+	if (path[0] && LibAvW_GetPixelFormat(pixel_format) == PIX_FMT_NONE)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_PIXEL_FORMAT;
+		return 0;
+	}
+	if (path[0] && (imagewidth <= 0 || imageheight <= 0))
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_FRAME_SIZE;
+		return 0;
+	}
+	if (path[0] && scaler != LIBAVW_SCALER_AUTO && (scaler < LIBAVW_SCALER_BILINEAR || scaler > LIBAVW_SCALER_SPLINE))
+	{
+		s->lasterror = LIBAVW_ERROR_CREATE_SCALE_CONTEXT;
+		return 0;
+	}
+	s->lasterror = LIBAVW_ERROR_NONE;
+	if (!strcmp(s->disk_path, path) && s->disk_pixelformat == pixel_format && s->disk_width == imagewidth && s->disk_height == imageheight && s->disk_scaler == scaler)
+		return 1;
+
+	// cache file of old path or settings is abandoned or dropped
+	if (s->disk_file)
+		LibAvW_Disk_Close(s);
+	memset(s->disk_path, 0, sizeof(s->disk_path));
+	strcpy(s->disk_path, path);
+	s->disk_pixelformat = pixel_format;
+	s->disk_width = imagewidth;
+	s->disk_height = imageheight;
+	s->disk_scaler = scaler;
+	s->disk_finished = false;
+	if (s->disk_view)
+		return LibAvW_Stream_DropCache(s);
+	return 1;
+}
+
+// LibAvW_StreamSetScalerBudget
+DLL_EXPORT int LibAvW_StreamSetScalerBudget(void *stream, int microseconds)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (microseconds < 0)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_SCALER_BUDGET;
+		return 0;
+	}
+
+	s->scaler_budget = microseconds;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_StreamGetAutoScaler
+DLL_EXPORT int LibAvW_StreamGetAutoScaler(void *stream)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return LIBAVW_SCALER_BILINEAR;
+	s = (avwstream_t *)stream;
+	return LibAvW_Stream_AutoScaler(s, LIBAVW_SCALER_AUTO);
+}
+
+// LibAvW_StreamSetAlphaMode
+DLL_EXPORT int LibAvW_StreamSetAlphaMode(void *stream, int mode)
+{
+	avwstream_t *s;
+	int layout;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	layout = mode & ~LIBAVW_ALPHA_PREMULTIPLY;
+	if (layout < LIBAVW_ALPHA_NONE || layout > LIBAVW_ALPHA_TOPBOTTOM)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_ALPHA_MODE;
+		return 0;
+	}
+	if (mode == s->alphamode)
+		return 1;
+
+	// cached images were converted with old layout
+	s->alphamode = mode;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return LibAvW_Stream_DropCache(s);
+}
+
+// LibAvW_StreamSetIdentity
+DLL_EXPORT int LibAvW_StreamSetIdentity(void *stream, const char *identity)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	memset(s->identity, 0, sizeof(s->identity));
+	if (identity)
+		strncpy(s->identity, identity, LIBAVW_MAX_IDENTITY - 1);
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_StreamSetNonBlockingIO
+DLL_EXPORT int LibAvW_StreamSetNonBlockingIO(void *stream, int enable)
+{
+	avwstream_t *s;
+	int ret;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	// pending frame has to be finished first
+	if (s->io_fiber && !enable)
+	{
+		while(s->io_inside)
+		{
+			ret = LibAvW_Stream_StepFrame(s);
+			if (ret == LIBAVW_PLAY_PENDING)
+				Sleep(1);
+			else if (!ret && s->lasterror == LIBAVW_ERROR_IO_PENDING)
+				return 0;
+		}
+	}
+	s->nonblocking = enable ? true : false;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_StreamSetPipelined
+DLL_EXPORT int LibAvW_StreamSetPipelined(void *stream, int enable)
+{
+	avwstream_t *s;
+	bool reverse;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	// prefetch thread of reverse playback owns demuxer, it is restarted around the change
+	reverse = s->reverse && !s->cache_playing;
+	if (reverse && !LibAvW_Stream_SetReverse(s, false))
+		return 0;
+
+	// packets read ahead are still decoded after demux thread is stopped
+	s->pipelined = enable ? true : false;
+	if (s->pipelined)
+		LibAvW_Demux_Start(s);
+	else
+		LibAvW_Demux_Stop(s, false);
+	s->lasterror = LIBAVW_ERROR_NONE;
+	if (reverse)
+		return LibAvW_Stream_SetReverse(s, true);
+	return 1;
+}
+
+// LibAvW_StreamSetDecodeMode
+DLL_EXPORT int LibAvW_StreamSetDecodeMode(void *stream, int mode)
+{
+	avwstream_t *s;
+	bool reverse;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
+
+	if (mode != LIBAVW_DECODE_ALL && mode != LIBAVW_DECODE_KEYFRAMES)
+	{
+		s->lasterror = LIBAVW_ERROR_BAD_DECODE_MODE;
+		return 0;
+	}
+	s->lasterror = LIBAVW_ERROR_NONE;
+	if (mode == s->decodemode)
+		return 1;
+
+	// prefetch thread of reverse playback owns decoder, it is restarted around the change
+	reverse = s->reverse && !s->cache_playing;
+	if (reverse && !LibAvW_Stream_SetReverse(s, false))
+		return 0;
+	s->decodemode = mode;
+	if (s->AV_CodecContext)
+		s->AV_CodecContext->skip_frame = (mode == LIBAVW_DECODE_KEYFRAMES) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+	if (mode == LIBAVW_DECODE_ALL && !reverse && s->framenum > 0)
+		s->skipped_refs = true;
 
-	// get decoder for video stream
-    s->AV_Codec = avcodec_find_decoder(s->AV_CodecContext->codec_id);
-    if (s->AV_Codec == NULL)
-    {
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_FIND_CODEC;
+	// cache filled in other mode is not a plain pass
+	if (!LibAvW_Stream_DropCache(s))
 		return 0;
-	}
+	if (reverse)
+		return LibAvW_Stream_SetReverse(s, true);
+	return 1;
+}
 
-	// open AV_Codec
-    // inform the AV_Codec that we can handle truncated bitstreams -- i.e.,
-    // bitstreams where AV_InputFrame boundaries can fall in the middle of packets
-    if (s->AV_Codec->capabilities & CODEC_CAP_TRUNCATED)
-		s->AV_CodecContext->flags |= CODEC_FLAG_TRUNCATED;
-#ifdef LIBAV95
-	if (avcodec_open2(s->AV_CodecContext, s->AV_Codec, NULL) < 0)
-#else
-	if (avcodec_open(s->AV_CodecContext, s->AV_Codec) < 0)
-#endif
-    {
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_OPEN_CODEC;
+// LibAvW_StreamSetPlaybackRate
+DLL_EXPORT int LibAvW_StreamSetPlaybackRate(void *stream, double rate)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
 		return 0;
-	}
 
-    // allocate UWV video AV_InputFrame
-	// get required buffer size and allocate buffer
-    // assign appropriate parts of buffer to image planes
-    s->AV_InputFrame = avcodec_alloc_frame();
-	if (!s->AV_InputFrame)
+	if (rate < LIBAVW_RATE_MIN || rate > LIBAVW_RATE_MAX)
 	{
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_ALLOC_INPUT_FRAME;
-        return 0;
+		s->lasterror = LIBAVW_ERROR_BAD_PLAYBACK_RATE;
+		return 0;
 	}
+	s->rate = rate;
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
 
-	// allocate output RGBA AV_InputFrame
-	s->AV_OutputFrame = avcodec_alloc_frame();
-	if (!s->AV_OutputFrame)
-	{
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_ALLOC_OUTPUT_FRAME;
-        return 0;
-	}
+// LibAvW_StreamGetPlaybackRate
+DLL_EXPORT double LibAvW_StreamGetPlaybackRate(void *stream)
+{
+	avwstream_t *s;
 
-	// all right, start AV_Codec
-	s->framenum = 0;
-	s->framewidth = s->AV_CodecContext->width;
-	s->frameheight = s->AV_CodecContext->height;
-	s->numframes = s->AV_FormatContext->streams[s->AV_VideoStreamId]->nb_frames;
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
 
-	// determine framerate
-	s->framerate = (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->avg_frame_rate.num / (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->avg_frame_rate.den;
-	if (s->framerate <= 1.0f || s->framerate > 100.0f)
-	{
-		s->framerate = (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->r_frame_rate.num / (float)s->AV_FormatContext->streams[s->AV_VideoStreamId]->r_frame_rate.den;
-		if (s->framerate <= 1.0f || s->framerate > 100.0f)
-			s->framerate = 15;
-	}
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return s->rate;
+}
 
-	// final checks
-	if (s->framewidth <= 0 || s->frameheight <= 0)
-	{
-		LibAvW_ResetStream(s);
-		s->lasterror = LIBAVW_ERROR_BAD_FRAME_SIZE;
-        return 0;
-	}
+// LibAvW_StreamSetFrameCache
+DLL_EXPORT int LibAvW_StreamSetFrameCache(void *stream, int64_t budget)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+	if (!LibAvW_Stream_CheckIdle(s))
+		return 0;
 
-	// allright
 	s->lasterror = LIBAVW_ERROR_NONE;
-	return 1;
+	if (budget < 0)
+		budget = 0;
+	s->cache_budget = budget;
+	s->cache_overflow = false;
+	if (s->cache_size <= budget)
+		return 1;
+	return LibAvW_Stream_DropCache(s);
 }
 
 // LibAvW_CreateStream
@@ -520,9 +5189,17 @@ DLL_EXPORT int LibAvW_CreateStream(void **stream)
 		return LIBAVW_ERROR_LIB_NOT_INITIALIZED;
 	// allocate
 	s = (avwstream_t *)malloc(sizeof(avwstream_t));
-	memset(s, 0, sizeof(avwstream_t));
 	if (s == NULL)
 		return LIBAVW_ERROR_ALLOC_STREAM;
+	memset(s, 0, sizeof(avwstream_t));
+	s->rate = 1.0;
+	s->auto_upwait = LIBAVW_AUTOSCALER_UPWAIT;
+	InitializeCriticalSection(&s->demux_lock);
+	InitializeCriticalSection(&s->cache_lock);
+	EnterCriticalSection(&libav_streams_lock);
+	s->next = libav_streams;
+	libav_streams = s;
+	LeaveCriticalSection(&libav_streams_lock);
 	*stream = s;
 	return LIBAVW_ERROR_NONE;
 }
@@ -530,15 +5207,192 @@ DLL_EXPORT int LibAvW_CreateStream(void **stream)
 // LibAvW_RemoveStream
 DLL_EXPORT void LibAvW_RemoveStream(void *stream)
 {
-	avwstream_t *s;
+	avwstream_t *s, **link;
 
 	if (!libav_initialized)
 		return;
 	s = (avwstream_t *)stream;
+	EnterCriticalSection(&libav_streams_lock);
+	for (link = &libav_streams; *link; link = &(*link)->next)
+	{
+		if (*link == s)
+		{
+			*link = s->next;
+			break;
+		}
+	}
+	LeaveCriticalSection(&libav_streams_lock);
 	LibAvW_ResetStream(s);
+	if (s->AV_InputFrame)
+		av_free(s->AV_InputFrame);
+	if (s->AV_OutputFrame)
+		av_free(s->AV_OutputFrame);
+	if (s->frameready_event)
+		CloseHandle(s->frameready_event);
+	LibAvW_Stream_FreeScalers(s);
+	DeleteCriticalSection(&s->demux_lock);
+	DeleteCriticalSection(&s->cache_lock);
 	free(s);
 }
 
+/*
+=================================================================
+
+ Log Queue
+
+ in deferred mode libav messages are not printed on the thread that
+ logs them but queued in a bounded lock-free ring which is drained
+ by the engine with LibAvW_PollLog
+
+=================================================================
+*/
+
+#define LIBAVW_LOG_SLOTS      256
+#define LIBAVW_LOG_LINE       256
+#define LIBAVW_LOG_RATELIMIT  200   // messages per second
+
+typedef struct avwlogslot_s
+{
+	volatile LONG sequence;
+	int           level;
+	void         *stream;
+	char          text[LIBAVW_LOG_LINE];
+}avwlogslot_t;
+
+bool              libav_log_deferred = false;
+avwlogslot_t      libav_log_slots[LIBAVW_LOG_SLOTS];
+volatile LONG     libav_log_head = 0;
+volatile LONG     libav_log_tail = 0;
+volatile LONG     libav_log_dropped = 0;
+volatile LONG     libav_log_repeated = 0;
+volatile LONG     libav_log_lasthash = 0;
+void * volatile   libav_log_laststream = NULL;
+volatile LONG     libav_log_second = 0;
+volatile LONG     libav_log_persecond = 0;
+
+// LibAvW_Log_Init
+void LibAvW_Log_Init(void)
+{
+	int i;
+
+	for (i = 0; i < LIBAVW_LOG_SLOTS; i++)
+		libav_log_slots[i].sequence = i;
+}
+
+// LibAvW_Log_Push
+// queues message, returns false if queue is full
+bool LibAvW_Log_Push(int level, void *stream, const char *text)
+{
+	avwlogslot_t *slot;
+	LONG pos, diff;
+
+	for (;;)
+	{
+		pos = libav_log_head;
+		slot = &libav_log_slots[pos & (LIBAVW_LOG_SLOTS - 1)];
+		diff = slot->sequence - pos;
+		if (diff < 0)
+			return false;
+		if (diff == 0 && InterlockedCompareExchange(&libav_log_head, pos + 1, pos) == pos)
+			break;
+	}
+	slot->level = level;
+	slot->stream = stream;
+	strncpy(slot->text, text, LIBAVW_LOG_LINE - 1);
+	slot->text[LIBAVW_LOG_LINE - 1] = 0;
+	InterlockedExchange(&slot->sequence, pos + 1);
+	return true;
+}
+
+// LibAvW_Log_Pop
+// single consumer, returns false if queue is empty
+bool LibAvW_Log_Pop(int *level, void **stream, char *text, int textsize)
+{
+	avwlogslot_t *slot;
+	LONG pos;
+
+	pos = libav_log_tail;
+	slot = &libav_log_slots[pos & (LIBAVW_LOG_SLOTS - 1)];
+	if (slot->sequence != pos + 1)
+		return false;
+	*level = slot->level;
+	*stream = slot->stream;
+	if (text && textsize > 0)
+	{
+		strncpy(text, slot->text, textsize - 1);
+		text[textsize - 1] = 0;
+	}
+	InterlockedExchange(&slot->sequence, pos + LIBAVW_LOG_SLOTS);
+	libav_log_tail = pos + 1;
+	return true;
+}
+
+// LibAvW_Log_Hash
+LONG LibAvW_Log_Hash(int level, void *stream, const char *text)
+{
+	unsigned int hash = (unsigned int)level * 31 + (unsigned int)(size_t)stream;
+
+	while(*text)
+		hash = hash * 33 + (unsigned char)*text++;
+	return (LONG)hash;
+}
+
+// LibAvW_Log_Message
+// rate limits and deduplicates message before queueing it
+void LibAvW_Log_Message(int level, void *stream, const char *text)
+{
+	LONG second, hash, repeated;
+	char line[64];
+
+	// rate limit
+	second = (LONG)(GetTickCount() / 1000);
+	if (InterlockedExchange(&libav_log_second, second) != second)
+		InterlockedExchange(&libav_log_persecond, 0);
+	if (InterlockedIncrement(&libav_log_persecond) > LIBAVW_LOG_RATELIMIT)
+	{
+		InterlockedIncrement(&libav_log_dropped);
+		return;
+	}
+
+	// same line over and over again
+	hash = LibAvW_Log_Hash(level, stream, text);
+	libav_log_laststream = stream;
+	if (InterlockedExchange(&libav_log_lasthash, hash) == hash)
+	{
+		InterlockedIncrement(&libav_log_repeated);
+		return;
+	}
+	repeated = InterlockedExchange(&libav_log_repeated, 0);
+	if (repeated > 0)
+	{
+		sprintf(line, "last message repeated %i times\n", (int)repeated);
+		if (!LibAvW_Log_Push(LIBAVW_PRINT_WARNING, stream, line))
+			InterlockedIncrement(&libav_log_dropped);
+	}
+	if (!LibAvW_Log_Push(level, stream, text))
+		InterlockedIncrement(&libav_log_dropped);
+}
+
+// LibAvW_Log_Stream
+// finds stream that owns the context libav is logging from
+void *LibAvW_Log_Stream(void *ptr)
+{
+	AVClass *avc;
+
+	if (!ptr)
+		return NULL;
+	avc = *(AVClass **)ptr;
+	if (!avc || !avc->class_name)
+		return NULL;
+	if (!strcmp(avc->class_name, "AVCodecContext"))
+		return ((AVCodecContext *)ptr)->opaque;
+	if (!strcmp(avc->class_name, "AVFormatContext") && ((AVFormatContext *)ptr)->pb)
+		return ((AVFormatContext *)ptr)->pb->opaque;
+	if (!strcmp(avc->class_name, "AVIOContext"))
+		return ((AVIOContext *)ptr)->opaque;
+	return NULL;
+}
+
 /*
 =================================================================
 
@@ -559,11 +5413,14 @@ void sanitize(char *line)
 }
 void LibAvW_ErrorCallback(void* ptr, int level, const char* fmt, va_list vl)
 {
+#ifndef LIBAV95
 	int print_prefix = 1;
+#endif
     char line[1024];
+	int printlevel;
 	
 	// we only want warning, error, fatal and panic
-	if (!libav_print)
+	if (!libav_print && !libav_log_deferred)
 		return;
 	if (level > AV_LOG_WARNING)
 		return;
@@ -574,13 +5431,245 @@ void LibAvW_ErrorCallback(void* ptr, int level, const char* fmt, va_list vl)
 #endif
     sanitize(line);
 	if (level == AV_LOG_WARNING)
-		libav_print(LIBAVW_PRINT_WARNING, line);
+		printlevel = LIBAVW_PRINT_WARNING;
 	else if (level == AV_LOG_ERROR)
-		libav_print(LIBAVW_PRINT_ERROR, line);
+		printlevel = LIBAVW_PRINT_ERROR;
 	else if (level == AV_LOG_FATAL)
-		libav_print(LIBAVW_PRINT_FATAL, line);
+		printlevel = LIBAVW_PRINT_FATAL;
 	else
-		libav_print(LIBAVW_PRINT_PANIC, line);
+		printlevel = LIBAVW_PRINT_PANIC;
+
+	// engine will pick it up with LibAvW_PollLog
+	if (libav_log_deferred)
+	{
+		LibAvW_Log_Message(printlevel, LibAvW_Log_Stream(ptr), line);
+		return;
+	}
+
+	// batched streams are decoded on worker threads
+	EnterCriticalSection(&libav_print_lock);
+	libav_print(printlevel, line);
+	LeaveCriticalSection(&libav_print_lock);
+}
+
+// LibAvW_SetDeferredLog
+DLL_EXPORT void LibAvW_SetDeferredLog(int enable)
+{
+	libav_log_deferred = enable ? true : false;
+}
+
+// LibAvW_PollLog
+DLL_EXPORT int LibAvW_PollLog(int *level, void **stream, char *text, int textsize)
+{
+	LONG dropped, repeated;
+	int l;
+	void *st;
+
+	if (!libav_initialized)
+		return 0;
+	if (LibAvW_Log_Pop(&l, &st, text, textsize))
+	{
+		if (level)
+			*level = l;
+		if (stream)
+			*stream = st;
+		return 1;
+	}
+
+	// queue is drained, burst of repeated line that was not followed by other line
+	repeated = InterlockedExchange(&libav_log_repeated, 0);
+	if (repeated > 0)
+	{
+		if (level)
+			*level = LIBAVW_PRINT_WARNING;
+		if (stream)
+			*stream = libav_log_laststream;
+		if (text && textsize > 0)
+			_snprintf(text, textsize, "last message repeated %i times\n", (int)repeated);
+		if (text && textsize > 0)
+			text[textsize - 1] = 0;
+		return 1;
+	}
+
+	// report lost messages
+	dropped = InterlockedExchange(&libav_log_dropped, 0);
+	if (dropped <= 0)
+		return 0;
+	if (level)
+		*level = LIBAVW_PRINT_WARNING;
+	if (stream)
+		*stream = NULL;
+	if (text && textsize > 0)
+		_snprintf(text, textsize, "%i log messages dropped\n", (int)dropped);
+	if (text && textsize > 0)
+		text[textsize - 1] = 0;
+	return 1;
+}
+
+// LibAvW_ClearProbeCache
+DLL_EXPORT void LibAvW_ClearProbeCache(void)
+{
+	int i;
+
+	if (!libav_initialized)
+		return;
+	EnterCriticalSection(&libav_probecache_lock);
+	for (i = 0; i < LIBAVW_PROBECACHE_SIZE; i++)
+		LibAvW_Probe_FreeEntry(&libav_probecache[i]);
+	LeaveCriticalSection(&libav_probecache_lock);
+}
+
+// LibAvW_SetMemoryFileLimit
+DLL_EXPORT void LibAvW_SetMemoryFileLimit(int64_t size)
+{
+	libav_memfile_limit = size;
+}
+
+// LibAvW_GetBufferPoolStats
+DLL_EXPORT void LibAvW_GetBufferPoolStats(avwpoolstats_t *stats)
+{
+	if (!libav_initialized || !stats)
+		return;
+	EnterCriticalSection(&libav_pool_lock);
+	*stats = libav_pool_stats;
+	LeaveCriticalSection(&libav_pool_lock);
+}
+
+// LibAvW_StreamGetMemoryUsage
+DLL_EXPORT int LibAvW_StreamGetMemoryUsage(void *stream, avwmemorystats_t *stats)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s || !stats)
+		return 0;
+
+	EnterCriticalSection(&libav_memory_lock);
+	*stats = s->memory;
+	LeaveCriticalSection(&libav_memory_lock);
+	s->lasterror = LIBAVW_ERROR_NONE;
+	return 1;
+}
+
+// LibAvW_GetMemoryUsage
+DLL_EXPORT void LibAvW_GetMemoryUsage(avwmemorystats_t *stats)
+{
+	if (!libav_initialized || !stats)
+		return;
+	EnterCriticalSection(&libav_memory_lock);
+	*stats = libav_memory;
+	LeaveCriticalSection(&libav_memory_lock);
+	EnterCriticalSection(&libav_pool_lock);
+	stats->pool = libav_pool_stats.freebytes;
+	LeaveCriticalSection(&libav_pool_lock);
+	stats->total += stats->pool;
+}
+
+// LibAvW_StreamGetAllocStats
+DLL_EXPORT int LibAvW_StreamGetAllocStats(void *stream, avwallocstats_t *stats)
+{
+	avwstream_t *s;
+
+	// check
+	if (!libav_initialized || !stats)
+		return 0;
+	s = (avwstream_t *)stream;
+	if (!s)
+		return 0;
+
+	memset(stats, 0, sizeof(avwallocstats_t));
+#ifdef LIBAVW_ALLOCTRACE
+	EnterCriticalSection(&libav_memory_lock);
+	*stats = s->allocstats;
+	LeaveCriticalSection(&libav_memory_lock);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// LibAvW_GetAllocStats
+DLL_EXPORT int LibAvW_GetAllocStats(avwallocstats_t *stats)
+{
+	if (!libav_initialized || !stats)
+		return 0;
+	memset(stats, 0, sizeof(avwallocstats_t));
+#ifdef LIBAVW_ALLOCTRACE
+	EnterCriticalSection(&libav_memory_lock);
+	*stats = libav_allocstats;
+	LeaveCriticalSection(&libav_memory_lock);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// LibAvW_SetTracing
+DLL_EXPORT void LibAvW_SetTracing(int enable)
+{
+	if (!libav_initialized)
+		return;
+	// ring is not cleared as spans may be written right now, older sessions are skipped by epoch
+	if (enable && !libav_tracing)
+	{
+		libav_trace_base = LibAvW_Timer();
+		InterlockedExchange(&libav_trace_first, libav_trace_next);
+		InterlockedIncrement(&libav_trace_epoch);
+	}
+	libav_tracing = enable ? true : false;
+}
+
+// LibAvW_DumpTrace
+DLL_EXPORT int LibAvW_DumpTrace(char *buffer, int buffersize)
+{
+	avwtraceevent_t e;
+	LONG next, first, index, epoch;
+	char line[256];
+	int len, linelen;
+
+	if (!libav_initialized)
+		return 0;
+
+	// oldest to newest, spans being written right now or left from older sessions are skipped
+	epoch = libav_trace_epoch;
+	first = libav_trace_first;
+	next = libav_trace_next;
+	if ((ULONG)(next - first) > LIBAVW_TRACE_EVENTS)
+		first = next - LIBAVW_TRACE_EVENTS;
+	len = 0;
+#define LIBAVW_TRACE_APPEND(text, textlen) { if (buffer && len + (textlen) < buffersize) memcpy(buffer + len, text, textlen); len += (textlen); }
+	LIBAVW_TRACE_APPEND("{\"traceEvents\":[", 15);
+	for (index = first; index != next; index++)
+	{
+		e = libav_trace_events[index & (LIBAVW_TRACE_EVENTS - 1)];
+		if (e.sequence != index + 1 || e.sequence != libav_trace_events[index & (LIBAVW_TRACE_EVENTS - 1)].sequence || e.epoch != epoch)
+			continue;
+		linelen = _snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"libavw\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu,\"args\":{\"stream\":\"%p\"}}", (len > 15) ? "," : "", e.name, (double)(e.start - libav_trace_base) * 1000000.0 / libav_timer_frequency, (double)(e.end - e.start) * 1000000.0 / libav_timer_frequency, (unsigned long)e.thread, e.stream);
+		if (linelen < 0 || linelen >= (int)sizeof(line))
+			continue;
+		LIBAVW_TRACE_APPEND(line, linelen);
+	}
+	LIBAVW_TRACE_APPEND("]}", 2);
+#undef LIBAVW_TRACE_APPEND
+	if (buffer && buffersize > 0)
+		buffer[FFMIN(len, buffersize - 1)] = 0;
+	return len + 1;
+}
+
+// LibAvW_SetScalerBudget
+DLL_EXPORT void LibAvW_SetScalerBudget(int microseconds)
+{
+	if (microseconds > 0)
+		libav_scaler_budget = microseconds;
+}
+
+// LibAvW_SetMemoryLimit
+DLL_EXPORT void LibAvW_SetMemoryLimit(int64_t limit)
+{
+	libav_memory_limit = limit;
 }
 
 // LibAvW_ErrorString
@@ -610,14 +5699,71 @@ DLL_EXPORT const char *LibAvW_ErrorString(int errorcode)
 	if (errorcode == LIBAVW_ERROR_CREATE_SCALE_CONTEXT) return "unable to create scale context";
 	if (errorcode == LIBAVW_ERROR_APPLYING_SCALE)       return "unable to apply scale";
 	if (errorcode == LIBAVW_ERROR_TEST)                 return "debug break";
+	if (errorcode == LIBAVW_ERROR_SEEK)                 return "unable to seek stream";
+	if (errorcode == LIBAVW_ERROR_MEMORY_LIMIT)         return "memory limit reached";
+	if (errorcode == LIBAVW_ERROR_LOCK_MANAGER)         return "unable to register lock manager";
+	if (errorcode == LIBAVW_ERROR_BAD_DECODE_MODE)      return "bad decode mode";
+	if (errorcode == LIBAVW_ERROR_BAD_PLAYBACK_RATE)    return "bad playback rate";
+	if (errorcode == LIBAVW_ERROR_BAD_ALPHA_MODE)       return "bad alpha mode";
+	if (errorcode == LIBAVW_ERROR_BAD_SCALER_BUDGET)    return "bad scaler budget";
+	if (errorcode == LIBAVW_ERROR_BAD_DISK_CACHE_PATH)  return "bad disk cache path";
+	if (errorcode == LIBAVW_ERROR_BAD_TILES)            return "bad tile layout";
+	if (errorcode == LIBAVW_ERROR_IO_PENDING)           return "frame of non-blocking read is pending";
+	if (errorcode == LIBAVW_ERROR_BATCH_REVERSE)        return "reversed stream can't be played in a batch";
 	return "unknown error code";
 }
 
+// LibAvW_InitFailed
+// lets another LibAvW_Init call try again
+int LibAvW_InitFailed(int errorcode)
+{
+	InterlockedExchange(&libav_init_state, 0);
+	return errorcode;
+}
+
+// LibAvW_LockManager
+// lets libavcodec serialize codec opening when streams are used from different threads
+int LibAvW_LockManager(void **mutex, enum AVLockOp op)
+{
+	switch(op)
+	{
+	case AV_LOCK_CREATE:
+		*mutex = malloc(sizeof(CRITICAL_SECTION));
+		if (!*mutex)
+			return 1;
+		InitializeCriticalSection((CRITICAL_SECTION *)*mutex);
+		return 0;
+	case AV_LOCK_OBTAIN:
+		EnterCriticalSection((CRITICAL_SECTION *)*mutex);
+		return 0;
+	case AV_LOCK_RELEASE:
+		LeaveCriticalSection((CRITICAL_SECTION *)*mutex);
+		return 0;
+	case AV_LOCK_DESTROY:
+		DeleteCriticalSection((CRITICAL_SECTION *)*mutex);
+		free(*mutex);
+		*mutex = NULL;
+		return 0;
+	}
+	return 1;
+}
+
 // LibAvW_Init
 DLL_EXPORT int LibAvW_Init(avwCallbackPrint *printfunction)
 {
-	if (libav_initialized)
-		return LIBAVW_ERROR_NONE;
+	LARGE_INTEGER frequency;
+	LONG state;
+
+	// only one thread initializes, others wait for it
+	for (;;)
+	{
+		state = InterlockedCompareExchange(&libav_init_state, 1, 0);
+		if (state == 0)
+			break;
+		if (state == 2)
+			return LIBAVW_ERROR_NONE;
+		Sleep(0);
+	}
 
 	libav_codec_version  = avcodec_version();
 	libav_format_version = avformat_version();
@@ -626,20 +5772,37 @@ DLL_EXPORT int LibAvW_Init(avwCallbackPrint *printfunction)
 
 	// only can use version we were linked against
 	if (libav_codec_version != LIBAVCODEC_VERSION_INT)
-		return LIBAVW_ERROR_DLL_VERSION_AVCODEC;
+		return LibAvW_InitFailed(LIBAVW_ERROR_DLL_VERSION_AVCODEC);
 	if (libav_format_version != LIBAVFORMAT_VERSION_INT)
-		return LIBAVW_ERROR_DLL_VERSION_AVFORMAT;
+		return LibAvW_InitFailed(LIBAVW_ERROR_DLL_VERSION_AVFORMAT);
 	if (libav_util_version != LIBAVUTIL_VERSION_INT)
-		return LIBAVW_ERROR_DLL_VERSION_AVUTIL;
+		return LibAvW_InitFailed(LIBAVW_ERROR_DLL_VERSION_AVUTIL);
 	if (libav_swscale_version != LIBSWSCALE_VERSION_INT)
-		return LIBAVW_ERROR_DLL_VERSION_SWSCALE;
+		return LibAvW_InitFailed(LIBAVW_ERROR_DLL_VERSION_SWSCALE);
+	if (av_lockmgr_register(LibAvW_LockManager))
+		return LibAvW_InitFailed(LIBAVW_ERROR_LOCK_MANAGER);
 
 	// allright, init libavcodec
+	QueryPerformanceFrequency(&frequency);
+	libav_timer_frequency = FFMAX(frequency.QuadPart, 1);
+	InitializeCriticalSection(&libav_print_lock);
+	InitializeCriticalSection(&libav_jobs_lock);
+	InitializeCriticalSection(&libav_jobs_current_lock);
+	InitializeCriticalSection(&libav_pool_lock);
+	InitializeCriticalSection(&libav_memory_lock);
+	InitializeCriticalSection(&libav_probecache_lock);
+	InitializeCriticalSection(&libav_frame_scalers_lock);
+	InitializeCriticalSection(&libav_streams_lock);
+#ifdef LIBAVW_ALLOCTRACE
+	LibAvW_Trace_Init();
+#endif
+	LibAvW_Log_Init();
 	avcodec_register_all();
 	av_register_all();
+	libav_print = printfunction;
 	av_log_set_callback(LibAvW_ErrorCallback);
 	libav_initialized = true;
-	libav_print = printfunction;
+	InterlockedExchange(&libav_init_state, 2);
 	return LIBAVW_ERROR_NONE;
 }
 
@@ -652,5 +5815,5 @@ DLL_EXPORT const char *LibAvW_AvcVersion(void)
 // get wrapper version
 DLL_EXPORT float LibAvW_Version(void)
 {
-	return (float)0.5;
+	return (float)0.7;
 }
\ No newline at end of file
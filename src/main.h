@@ -40,22 +40,137 @@
 #define LIBAVW_SCALER_SINC       7
 #define LIBAVW_SCALER_LANCZOS    8
 #define LIBAVW_SCALER_SPLINE     9
+#define LIBAVW_SCALER_AUTO       10 // spline down to bicubic, bilinear or point to stay within conversion budget
 
 // output format
 #define LIBAVW_PIXEL_FORMAT_BGR  0
 #define LIBAVW_PIXEL_FORMAT_BGRA 1
 
+// non-blocking read callback result, no data available yet
+#define LIBAVW_IO_WOULDBLOCK     -11
+
+// LibAvW_PlaySeekNextFrame result
+#define LIBAVW_PLAY_END          0
+#define LIBAVW_PLAY_FRAME        1
+#define LIBAVW_PLAY_PENDING      2 // next frame is not there yet (waiting for data or out of time budget), call again later
+
+// decode mode
+#define LIBAVW_DECODE_ALL        0
+#define LIBAVW_DECODE_KEYFRAMES  1 // only keyframes are decoded, for fast scrubbing
+
+// alpha layout
+#define LIBAVW_ALPHA_NONE        0 // picture is opaque
+#define LIBAVW_ALPHA_NATIVE      1 // alpha plane of the video (yuva420p)
+#define LIBAVW_ALPHA_SIDEBYSIDE  2 // color in left half, alpha matte luma in right half
+#define LIBAVW_ALPHA_TOPBOTTOM   3 // color in top half, alpha matte luma in bottom half
+#define LIBAVW_ALPHA_PREMULTIPLY 0x100 // flag, color is multiplied by alpha
+
+// playback rate
+#define LIBAVW_RATE_MIN          0.0625
+#define LIBAVW_RATE_MAX          16.0
+#define LIBAVW_RATE_NONREF       1.5  // non-reference frames are skipped from this speed
+#define LIBAVW_RATE_KEYFRAMES    4.0  // only keyframes are decoded from this speed
+
 // print levels
 #define LIBAVW_PRINT_WARNING     1
 #define LIBAVW_PRINT_ERROR       2
 #define LIBAVW_PRINT_FATAL       3
 #define LIBAVW_PRINT_PANIC       4
 
+// flipbook cell
+typedef struct avwflipbookrect_s
+{
+	int    x;
+	int    y;
+	int    width;
+	int    height;
+	double time;
+}avwflipbookrect_t;
+
+// batch frame request status
+#define LIBAVW_BATCH_ERROR      -1
+#define LIBAVW_BATCH_NOFRAME     0 // stream is already at requested time
+#define LIBAVW_BATCH_NEWFRAME    1
+#define LIBAVW_BATCH_END         2 // reached end of stream
+#define LIBAVW_BATCH_PENDING     3 // non-blocking stream waits for data, request again later
+
+// batch frame request
+typedef struct avwframerequest_s
+{
+	void  *stream;
+	double time;         // stream time of wanted frame, in seconds
+	void  *imagedata;    // NULL to only advance stream
+	int    pixel_format;
+	int    imagewidth;
+	int    imageheight;
+	int    scaler;
+	int    status;       // set by LibAvW_PlayFrames
+	int    error;        // set by LibAvW_PlayFrames
+}avwframerequest_t;
+
+// frame buffer pool statistics
+typedef struct avwpoolstats_s
+{
+	int64_t allocated;   // bytes held by pool, in use or free
+	int64_t freebytes;   // bytes waiting for reuse
+	int     numbuffers;
+	int     numfree;
+	int64_t hits;        // requests served by reusing a buffer
+	int64_t misses;      // requests that needed a new allocation
+}avwpoolstats_t;
+
+// memory usage, in bytes
+typedef struct avwmemorystats_s
+{
+	int64_t total;
+	int64_t iobuffers;   // demuxer input buffers
+	int64_t memfiles;    // small files loaded into memory
+	int64_t frames;      // decoded frames, including codec reference frames
+	int64_t caches;      // converted frame caches
+	int64_t pool;        // unused frame buffers held by pool (global only)
+	int64_t packets;     // demuxed packets queued in pipelined mode
+	int64_t scalers;     // scale contexts kept by streams and held frame conversion (estimated, libav does not report their size)
+	int64_t tiles;       // full frames kept for tiled output of scaled or alpha-packed video
+}avwmemorystats_t;
+
+// allocation counts, only collected by builds with LIBAVW_ALLOCTRACE defined
+typedef struct avwallocstats_s
+{
+	int64_t allocs;           // allocations made by traced API calls of stream (all allocations for global stats)
+	int64_t bytes;
+	int64_t calls;            // traced API calls (next frame, advance, get image)
+	int64_t frames;           // decoded frames
+	int64_t lastcall_allocs;  // allocations made by last traced call
+	int64_t lastcall_bytes;
+	int64_t lastframe_allocs; // allocations made while decoding last frame
+	int64_t lastframe_bytes;
+}avwallocstats_t;
+
+// frame held with LibAvW_AcquireFrame, planes stay valid until LibAvW_ReleaseFrame
+typedef struct avwframeinfo_s
+{
+	int      width;
+	int      height;
+	int      format;      // libav pixel format of planes
+	uint8_t *data[4];
+	int      linesize[4];
+	double   pts;
+	double   duration;
+}avwframeinfo_t;
+
 // exported callback functions:
 typedef void    avwCallbackPrint(int, const char *);
-typedef int     avwCallbackIoRead(void *, uint8_t *, int);
+typedef int     avwCallbackIoRead(void *, uint8_t *, int); // may return LIBAVW_IO_WOULDBLOCK in non-blocking mode
 typedef int64_t avwCallbackIoSeek(void *, int64_t, int);
 typedef int64_t avwCallbackIoSeekSize(void *);
+typedef void    avwCallbackFrameReady(void *, void *, double);
+
+// threading:
+// library is initialized once even if LibAvW_Init is called from several threads at once,
+// after that distinct streams can be driven from different threads at the same time
+// (codec opening is serialized through a libavcodec lock manager, shared frame pool,
+// memory counters and print callback are locked), a single stream still must not be
+// used by two threads at once
 
 // exported functions:
 
@@ -71,21 +186,181 @@ DLL_EXPORT const char *LibAvW_AvcVersion(void);
 // get wrapper version
 DLL_EXPORT float LibAvW_Version(void);
 
+// get statistics of decoded frame buffer pool shared by all streams
+DLL_EXPORT void LibAvW_GetBufferPoolStats(avwpoolstats_t *stats);
+
+// get memory held by stream or by whole library
+DLL_EXPORT int LibAvW_StreamGetMemoryUsage(void *stream, avwmemorystats_t *stats);
+DLL_EXPORT void LibAvW_GetMemoryUsage(avwmemorystats_t *stats);
+
+// get allocation counts of stream or of whole library, returns 0 if tracing is not built in
+DLL_EXPORT int LibAvW_StreamGetAllocStats(void *stream, avwallocstats_t *stats);
+DLL_EXPORT int LibAvW_GetAllocStats(avwallocstats_t *stats);
+
+// record spans (open, probe, read callback, demux, decode, convert, seek) of all streams and threads
+// into an in-memory ring of recent events, enabling clears the ring
+DLL_EXPORT void LibAvW_SetTracing(int enable);
+
+// write recorded spans as Chrome trace JSON (chrome://tracing, Perfetto), returns buffer size
+// needed including terminating zero, output is truncated if buffer is smaller (buffer may be NULL)
+DLL_EXPORT int LibAvW_DumpTrace(char *buffer, int buffersize);
+
+// conversion time budget of LIBAVW_SCALER_AUTO in microseconds for streams without own budget (default 4000)
+DLL_EXPORT void LibAvW_SetScalerBudget(int microseconds);
+
+// limit memory used by library, 0 is unlimited (default)
+// when over limit opening a stream first drops frame caches other streams are still filling
+// and frees unused pool buffers, then new streams are decoded
+// at lower resolution, and then LibAvW_PlayVideo fails with memory limit error
+DLL_EXPORT void LibAvW_SetMemoryLimit(int64_t limit);
+
+// deferred log: libav messages are queued instead of being printed from whatever
+// thread libav logs on, repeated lines are collapsed and flood is rate limited
+DLL_EXPORT void LibAvW_SetDeferredLog(int enable);
+
+// get next queued log message, stream is the stream that produced it (or NULL),
+// returns 0 when queue is empty, single consumer only (call from one thread at a time)
+DLL_EXPORT int LibAvW_PollLog(int *level, void **stream, char *text, int textsize);
+
+// files not larger than size are read into memory once on LibAvW_PlayVideo
+// and demuxed from there (needs IoSeekSize), 0 disables (default)
+DLL_EXPORT void LibAvW_SetMemoryFileLimit(int64_t size);
+
+// forget all cached probe results (see LibAvW_StreamSetIdentity)
+DLL_EXPORT void LibAvW_ClearProbeCache(void);
+
 // create stream, returns error code
 DLL_EXPORT int LibAvW_CreateStream(void **stream);
 
 // flush and remove stream
-DLL_EXPORT void LibAv_RemoveStream(void *stream);
+DLL_EXPORT void LibAvW_RemoveStream(void *stream);
 
 // get video parameters of stream
 DLL_EXPORT int LibAvW_StreamGetVideoWidth(void *stream);
 DLL_EXPORT int LibAvW_StreamGetVideoHeight(void *stream);
 DLL_EXPORT double LibAvW_StreamGetFramerate(void *stream);
 
+// get presentation time and duration of current frame and expected time and duration of next frame,
+// returns 0 if no frame was decoded yet
+DLL_EXPORT int LibAvW_StreamGetFrameTime(void *stream, double *pts, double *duration, double *nextpts, double *nextduration);
+
+// frame ready notification, callback gets stream, userdata and frame pts
+// and is called from the thread that made the frame (worker thread for LibAvW_PlayFrames),
+// event is a Win32 auto-reset event handle signalled at the same time
+DLL_EXPORT int LibAvW_StreamSetFrameCallback(void *stream, avwCallbackFrameReady *callback, void *userdata);
+DLL_EXPORT void *LibAvW_StreamGetFrameEvent(void *stream);
+
 // get last function errorcode from stream
 DLL_EXPORT int LibAvW_StreamGetError(void *stream);
 
 // simple API to play video
 DLL_EXPORT int LibAvW_PlayVideo(void *stream, void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize);
 DLL_EXPORT int LibAvW_PlaySeekNextFrame(void *stream);
-DLL_EXPORT int LibAvW_PlayGetFrameImage(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler);
\ No newline at end of file
+
+// same as LibAvW_PlaySeekNextFrame but stops between packets once budget (microseconds) is spent,
+// returns LIBAVW_PLAY_PENDING then, next call continues where this one stopped
+DLL_EXPORT int LibAvW_PlaySeekNextFrameBudget(void *stream, int budget);
+// write current frame at video size (LibAvW_StreamGetVideoWidth/Height), image size is only used for row pitch and bounds
+DLL_EXPORT int LibAvW_PlayGetFrameImage(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler);
+
+// write current frame scaled to imagewidth x imageheight
+DLL_EXPORT int LibAvW_PlayGetFrameImageScaled(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler);
+
+// decode first keyframe (or keyframe nearest before time) of a file into image without
+// setting up a stream for playback, returns error code
+DLL_EXPORT int LibAvW_ExtractThumbnail(void *file, avwCallbackIoRead *IoRead, avwCallbackIoSeek *IoSeek, avwCallbackIoSeekSize *IoSeekSize, double time, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler);
+
+// write full mip chain of current frame (level 0 is imagewidth x imageheight, each next level is halved
+// down to 1x1 or maxlevels, 0 is unlimited) tightly packed into imagedata, returns number of levels,
+// levels are box filtered in YUV before color conversion, alpha mode is not applied, imagewidth must be 8 or more
+DLL_EXPORT int LibAvW_PlayGetFrameMipmaps(void *stream, int pixel_format, void *imagedata, int imagewidth, int imageheight, int maxlevels, int scaler);
+
+// size in bytes of mip chain for LibAvW_PlayGetFrameMipmaps
+DLL_EXPORT int LibAvW_GetMipmapChainSize(int pixel_format, int width, int height, int maxlevels);
+
+// write current frame as imagewidth x imageheight image split into tilewidth x tileheight tiles, row by row,
+// each tile buffer holds (tilewidth + 2 * border) x (tileheight + 2 * border) pixels including neighbouring
+// pixels around tile, pixels past image edges repeat them, frames not scaled are converted straight into tiles
+// (others go through full frame kept by stream until LibAvW_PlayVideo or LibAvW_RemoveStream)
+DLL_EXPORT int LibAvW_PlayGetFrameTiles(void *stream, int pixel_format, int imagewidth, int imageheight, int tilewidth, int tileheight, int border, void **tiles, int numtiles, int scaler);
+
+// get reference-counted handle of current frame (decoded planes and metadata), decoding goes on
+// into other buffers so the frame stays valid until released, returns NULL if there is no frame,
+// handles may outlive their stream and may be used and released from any thread
+DLL_EXPORT void *LibAvW_AcquireFrame(void *stream, avwframeinfo_t *info);
+DLL_EXPORT void LibAvW_ReleaseFrame(void *frame);
+
+// convert held frame into image
+DLL_EXPORT int LibAvW_FrameGetImage(void *frame, int pixel_format, void *imagedata, int imagewidth, int imageheight, int scaler);
+
+// advance and convert many streams at once (in parallel on multicore systems),
+// each stream should appear only once, returns number of streams with new frames,
+// reversed streams fail with LIBAVW_BATCH_ERROR, non-blocking streams may be LIBAVW_BATCH_PENDING
+// (their frames are decoded on fibers, worker threads are converted to fibers)
+DLL_EXPORT int LibAvW_PlayFrames(avwframerequest_t *requests, int numrequests);
+
+// decode whole stream (every framestep'th frame) into an atlas of cellwidth x cellheight cells,
+// fills rects and returns number of packed frames, playback position, reverse and cache mode are
+// restored afterwards, cells are decoded and converted one by one on calling thread (no worker threads)
+DLL_EXPORT int LibAvW_PlayGetFlipbook(void *stream, int pixel_format, void *atlasdata, int atlaswidth, int atlasheight, int cellwidth, int cellheight, int framestep, int scaler, avwflipbookrect_t *rects, int maxrects);
+
+// seek to the frame that covers time (to keyframe at or before time in keyframe decode mode)
+DLL_EXPORT int LibAvW_PlaySeekTime(void *stream, double time);
+
+// step back one frame (one keyframe in keyframe decode mode), returns 0 at first frame
+DLL_EXPORT int LibAvW_PlaySeekPrevFrame(void *stream);
+
+// play stream backwards from current frame (or from the end if nothing was played yet),
+// LibAvW_PlaySeekNextFrame then returns previous frames, GOPs are decoded into a buffer
+// on a background thread, reversed stream is refused by LibAvW_PlayFrames
+DLL_EXPORT int LibAvW_StreamSetReverse(void *stream, int reverse);
+
+// advance stream clock by elapsed seconds times playback rate and step to the frame that covers it,
+// returns 1 if a new frame is presented, 2 if current frame is still valid, 0 at end of stream
+DLL_EXPORT int LibAvW_PlayAdvance(void *stream, double elapsed);
+
+// set playback speed used by LibAvW_PlayAdvance (1.0 is normal speed), survives LibAvW_PlayVideo,
+// at high speeds non-reference frames are skipped and at extreme speeds only keyframes are decoded
+// (first frame decoded at lower speed after that is seeked from its keyframe)
+DLL_EXPORT int LibAvW_StreamSetPlaybackRate(void *stream, double rate);
+DLL_EXPORT double LibAvW_StreamGetPlaybackRate(void *stream);
+
+// set LIBAVW_ALPHA_* layout (optionally with LIBAVW_ALPHA_PREMULTIPLY) used when converting frames,
+// alpha ends up in BGRA images, packed matte layouts also halve reported video width or height
+DLL_EXPORT int LibAvW_StreamSetAlphaMode(void *stream, int mode);
+
+// conversion time budget of LIBAVW_SCALER_AUTO in microseconds, 0 uses global budget, survives LibAvW_PlayVideo
+DLL_EXPORT int LibAvW_StreamSetScalerBudget(void *stream, int microseconds);
+// LIBAVW_SCALER_* currently picked by LIBAVW_SCALER_AUTO
+DLL_EXPORT int LibAvW_StreamGetAutoScaler(void *stream);
+
+// identify file of following LibAvW_PlayVideo calls (e.g. name + size + mtime, or a hash),
+// probe results of identified files are cached so reopening them skips format and stream info probing,
+// NULL or empty string clears identity
+DLL_EXPORT int LibAvW_StreamSetIdentity(void *stream, const char *identity);
+
+// in non-blocking mode read callback may return LIBAVW_IO_WOULDBLOCK, then LibAvW_PlaySeekNextFrame
+// returns LIBAVW_PLAY_PENDING and resumes reading on next call (frame is decoded on a Win32 fiber),
+// while a frame is pending seeks, rewinds, flipbooks and mode changes fail with LIBAVW_ERROR_IO_PENDING,
+// calling thread is converted to a fiber once and stays one, other calls wait for data
+DLL_EXPORT int LibAvW_StreamSetNonBlockingIO(void *stream, int enable);
+
+// pipelined mode: packets are read ahead on a demux thread into bounded video and audio queues
+// (up to 2 seconds or 8 MB of video) so I/O overlaps with decoding, survives LibAvW_PlayVideo
+DLL_EXPORT int LibAvW_StreamSetPipelined(void *stream, int enable);
+
+// set LIBAVW_DECODE_* mode of stream, applies immediately and to following LibAvW_PlayVideo calls
+DLL_EXPORT int LibAvW_StreamSetDecodeMode(void *stream, int mode);
+
+// seek stream back to the first frame (for looping)
+DLL_EXPORT int LibAvW_PlayRewind(void *stream);
+
+// keep converted frames in memory (up to budget bytes) so looped playback
+// is served from memory after the first pass, 0 disables the cache
+DLL_EXPORT int LibAvW_StreamSetFrameCache(void *stream, int64_t budget);
+
+// write converted frames of first playback of an identified file (see LibAvW_StreamSetIdentity) into
+// cache file at path, later opens and rewinds of same file play from the mapped file without decoding,
+// frames are written and taken only for given output settings (LIBAVW_SCALER_AUTO takes file of any scaler),
+// decoder is not opened while playing from mapped file, NULL or empty path disables, survives LibAvW_PlayVideo
+DLL_EXPORT int LibAvW_StreamSetDiskCache(void *stream, const char *path, int pixel_format, int imagewidth, int imageheight, int scaler);
\ No newline at end of file
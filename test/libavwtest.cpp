@@ -0,0 +1,309 @@
+/*
+	Libavcodec integration for Darkplaces by Timofeyev Pavel
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+	See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to:
+
+		Free Software Foundation, Inc.
+		59 Temple Place - Suite 330
+		Boston, MA  02111-1307, USA
+*/
+
+// test harness, plays a short clip given on command line (a few seconds with several GOPs)
+// and checks frame cache rewind, reverse playback and pending paths of non-blocking and budget modes
+// usage: libavwtest.exe clip.avi
+
+#include <stdio.h>
+#include <string.h>
+#include "../src/main.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define TEST_MAX_FRAMES 4096
+
+typedef struct testfile_s
+{
+	FILE            *f;
+	bool             wouldblock;         // every other read would block
+	int              reads;
+}testfile_t;
+
+typedef struct testpass_s
+{
+	double           pts[TEST_MAX_FRAMES];
+	int              numframes;
+	int              pending;            // LIBAVW_PLAY_PENDING returns
+	int              seeks;              // seeks allowed while a frame was pending
+}testpass_t;
+
+const char *test_path;
+testpass_t  test_reference;
+int         test_failed = 0;
+
+// Test_Read
+int Test_Read(void *file, uint8_t *buf, int size)
+{
+	testfile_t *t = (testfile_t *)file;
+
+	if (t->wouldblock && !(t->reads++ & 1))
+		return LIBAVW_IO_WOULDBLOCK;
+	return (int)fread(buf, 1, size, t->f);
+}
+
+// Test_Seek
+int64_t Test_Seek(void *file, int64_t offset, int whence)
+{
+	testfile_t *t = (testfile_t *)file;
+
+	if (_fseeki64(t->f, offset, whence))
+		return -1;
+	return _ftelli64(t->f);
+}
+
+// Test_SeekSize
+int64_t Test_SeekSize(void *file)
+{
+	testfile_t *t = (testfile_t *)file;
+	int64_t pos, size;
+
+	pos = _ftelli64(t->f);
+	_fseeki64(t->f, 0, SEEK_END);
+	size = _ftelli64(t->f);
+	_fseeki64(t->f, pos, SEEK_SET);
+	return size;
+}
+
+// Test_Check
+void Test_Check(bool ok, const char *test, const char *what)
+{
+	if (ok)
+		return;
+	printf("%s: FAILED, %s\n", test, what);
+	test_failed++;
+}
+
+// Test_Open
+// creates stream and starts playing test clip, frame cache budget is set before LibAvW_PlayVideo
+void *Test_Open(testfile_t *t, const char *test, int64_t cachebudget)
+{
+	void *stream;
+
+	memset(t, 0, sizeof(*t));
+	t->f = fopen(test_path, "rb");
+	if (!t->f)
+	{
+		Test_Check(false, test, "can't open clip");
+		return NULL;
+	}
+	if (LibAvW_CreateStream(&stream) != 0)
+	{
+		fclose(t->f);
+		Test_Check(false, test, "can't create stream");
+		return NULL;
+	}
+	LibAvW_StreamSetFrameCache(stream, cachebudget);
+	if (!LibAvW_PlayVideo(stream, t, Test_Read, Test_Seek, Test_SeekSize))
+	{
+		printf("%s: %s\n", test, LibAvW_ErrorString(LibAvW_StreamGetError(stream)));
+		LibAvW_RemoveStream(stream);
+		fclose(t->f);
+		Test_Check(false, test, "can't play clip");
+		return NULL;
+	}
+	return stream;
+}
+
+// Test_Close
+void Test_Close(void *stream, testfile_t *t)
+{
+	LibAvW_RemoveStream(stream);
+	fclose(t->f);
+}
+
+// Test_Play
+// steps stream to its end, image is converted for every frame when given,
+// seeks tried while frames are pending must be refused
+void Test_Play(void *stream, testpass_t *pass, unsigned char *image, int budget, bool seekpending)
+{
+	double pts;
+	int ret;
+
+	pass->numframes = 0;
+	pass->pending = 0;
+	pass->seeks = 0;
+	for (;;)
+	{
+		ret = budget ? LibAvW_PlaySeekNextFrameBudget(stream, budget) : LibAvW_PlaySeekNextFrame(stream);
+		if (ret == LIBAVW_PLAY_PENDING)
+		{
+			pass->pending++;
+			if (seekpending && LibAvW_PlaySeekTime(stream, 0))
+				pass->seeks++;
+			continue;
+		}
+		if (ret != LIBAVW_PLAY_FRAME || pass->numframes >= TEST_MAX_FRAMES)
+			break;
+		LibAvW_StreamGetFrameTime(stream, &pts, NULL, NULL, NULL);
+		pass->pts[pass->numframes++] = pts;
+		if (image)
+			LibAvW_PlayGetFrameImage(stream, LIBAVW_PIXEL_FORMAT_BGRA, image, LibAvW_StreamGetVideoWidth(stream), LibAvW_StreamGetVideoHeight(stream), LIBAVW_SCALER_BILINEAR);
+	}
+}
+
+// Test_SameFrames
+bool Test_SameFrames(testpass_t *a, testpass_t *b)
+{
+	int i;
+
+	if (a->numframes != b->numframes)
+		return false;
+	for (i = 0; i < a->numframes; i++)
+		if (a->pts[i] != b->pts[i])
+			return false;
+	return true;
+}
+
+// Test_CacheRewind
+// second pass is served from frame cache and must be as long as the decoded one
+void Test_CacheRewind(void)
+{
+	testfile_t t;
+	testpass_t pass;
+	avwmemorystats_t stats;
+	unsigned char *image;
+	void *stream;
+
+	stream = Test_Open(&t, "cache rewind", 1024 * 1024 * 1024);
+	if (!stream)
+		return;
+	image = (unsigned char *)malloc(LibAvW_StreamGetVideoWidth(stream) * LibAvW_StreamGetVideoHeight(stream) * 4);
+	Test_Play(stream, &pass, image, 0, false);
+	Test_Check(Test_SameFrames(&pass, &test_reference), "cache rewind", "first pass differs from reference");
+	Test_Check(LibAvW_PlayRewind(stream) != 0, "cache rewind", "rewind failed");
+	LibAvW_StreamGetMemoryUsage(stream, &stats);
+	Test_Check(stats.caches > 0, "cache rewind", "nothing was cached");
+	Test_Play(stream, &pass, image, 0, false);
+	Test_Check(pass.numframes == test_reference.numframes, "cache rewind", "cached pass has other length");
+	free(image);
+	Test_Close(stream, &t);
+}
+
+// Test_Reverse
+// reversed stream started before playing gives all frames from the last one
+void Test_Reverse(void)
+{
+	testfile_t t;
+	testpass_t pass;
+	void *stream;
+	int i;
+
+	stream = Test_Open(&t, "reverse", 0);
+	if (!stream)
+		return;
+	Test_Check(LibAvW_StreamSetReverse(stream, 1) != 0, "reverse", "can't reverse stream");
+	Test_Play(stream, &pass, NULL, 0, false);
+	Test_Check(pass.numframes == test_reference.numframes, "reverse", "reversed pass has other length");
+	for (i = 0; i < pass.numframes && i < test_reference.numframes; i++)
+		if (pass.pts[i] != test_reference.pts[test_reference.numframes - 1 - i])
+			break;
+	Test_Check(i == pass.numframes, "reverse", "frames are not in reverse order");
+	Test_Close(stream, &t);
+}
+
+// Test_NonBlocking
+// every other read would block, frames must come out same as with blocking reads
+void Test_NonBlocking(void)
+{
+	testfile_t t;
+	testpass_t pass;
+	void *stream;
+
+	stream = Test_Open(&t, "non-blocking", 0);
+	if (!stream)
+		return;
+	Test_Check(LibAvW_StreamSetNonBlockingIO(stream, 1) != 0, "non-blocking", "can't set non-blocking mode");
+	t.wouldblock = true;
+	Test_Play(stream, &pass, NULL, 0, true);
+	Test_Check(pass.pending > 0, "non-blocking", "no frame was pending");
+	Test_Check(pass.seeks == 0, "non-blocking", "seek was allowed while frame is pending");
+	Test_Check(Test_SameFrames(&pass, &test_reference), "non-blocking", "frames differ from reference");
+	Test_Close(stream, &t);
+}
+
+// Test_Budget
+// tiny budget makes frames pending between packets, resumed frames must match reference
+void Test_Budget(void)
+{
+	testfile_t t;
+	testpass_t pass;
+	void *stream;
+
+	stream = Test_Open(&t, "budget", 0);
+	if (!stream)
+		return;
+	Test_Play(stream, &pass, NULL, 1, false);
+	Test_Check(Test_SameFrames(&pass, &test_reference), "budget", "frames differ from reference");
+	printf("budget: %i frames, %i pending returns\n", pass.numframes, pass.pending);
+	Test_Close(stream, &t);
+}
+
+// Test_Print
+void Test_Print(int level, const char *text)
+{
+	printf("libavw %i: %s", level, text);
+}
+
+int main(int argc, char **argv)
+{
+	testfile_t t;
+	void *stream;
+
+	if (argc < 2)
+	{
+		printf("usage: libavwtest <clip>\n");
+		return 2;
+	}
+	test_path = argv[1];
+	if (LibAvW_Init(Test_Print) != 0)
+	{
+		printf("LibAvW_Init failed\n");
+		return 2;
+	}
+
+	// reference pass with blocking reads and no cache
+	stream = Test_Open(&t, "reference", 0);
+	if (!stream)
+		return 1;
+	Test_Play(stream, &test_reference, NULL, 0, false);
+	Test_Close(stream, &t);
+	if (test_reference.numframes < 2)
+	{
+		printf("reference: clip has less than 2 frames\n");
+		return 1;
+	}
+	printf("reference: %i frames\n", test_reference.numframes);
+
+	Test_CacheRewind();
+	Test_Reverse();
+	Test_NonBlocking();
+	Test_Budget();
+	if (test_failed)
+	{
+		printf("%i checks failed\n", test_failed);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}